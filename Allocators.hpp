@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+namespace metaprogramming {
+
+// Hands out memory by bumping a pointer through blocks obtained from
+// operator new, each twice as large as the one before. Nothing is freed
+// before release() or destruction, so allocation is a few instructions and
+// deallocation is free. Suited to arrays that all die together, e.g. at the
+// end of a request. Not thread-safe.
+class MonotonicArena {
+  struct Block {
+    Block * next;
+  };
+
+  Block * blocks;
+  char * current;
+  char * end;
+  size_t next_block_size;
+
+  void grow(size_t bytes, size_t alignment) {
+    size_t size = std::max(next_block_size,
+      sizeof(Block) + alignment + bytes);
+    Block * block = static_cast<Block *>(::operator new(size));
+    block->next = blocks;
+    blocks = block;
+    current = reinterpret_cast<char *>(block + 1);
+    end = reinterpret_cast<char *>(block) + size;
+    next_block_size = 2 * std::max(next_block_size, size);
+  }
+
+public:
+  explicit MonotonicArena(size_t initial_block_size = 64 * 1024)
+    : blocks(nullptr)
+    , current(nullptr)
+    , end(nullptr)
+    , next_block_size(initial_block_size) { }
+
+  MonotonicArena(const MonotonicArena &) = delete;
+  MonotonicArena & operator=(const MonotonicArena &) = delete;
+
+  ~MonotonicArena() {
+    release();
+    ::operator delete(blocks);
+  }
+
+  void * allocate(size_t bytes, size_t alignment) {
+    auto align = [&] {
+      uintptr_t p = reinterpret_cast<uintptr_t>(current);
+      return reinterpret_cast<char *>((p + alignment - 1) & ~(alignment - 1));
+    };
+    char * p = align();
+    if (!current || end < p || size_t(end - p) < bytes) {
+      grow(bytes, alignment);
+      p = align();
+    }
+    current = p + bytes;
+    return p;
+  }
+
+  // Makes all memory available again, invalidating everything allocated so
+  // far. The largest block is kept, so a steady workload stops calling
+  // operator new after the first round.
+  void release() {
+    if (!blocks) return;
+    while (Block * next = blocks->next) {
+      blocks->next = next->next;
+      ::operator delete(next);
+    }
+    current = reinterpret_cast<char *>(blocks + 1);
+  }
+};
+
+// Recycles freed blocks through free lists of power-of-two size classes
+// from 16 bytes to 8 MiB, so arrays that are created and destroyed over and
+// over reuse the same memory instead of going through malloc. Larger
+// requests go straight to operator new. Cached blocks are returned on
+// release() or destruction. Not thread-safe.
+class SizeClassPool {
+  struct Node {
+    Node * next;
+  };
+
+  static constexpr size_t min_size = 16;
+  static constexpr size_t class_count = 20;
+
+  Node * free_lists[class_count];
+
+  // Smallest size class that holds bytes, or class_count if none does
+  static size_t size_class(size_t bytes) {
+    size_t k = 0;
+    while (k < class_count && (min_size << k) < bytes) ++k;
+    return k;
+  }
+
+public:
+  SizeClassPool() { std::fill(free_lists, free_lists + class_count, nullptr); }
+
+  SizeClassPool(const SizeClassPool &) = delete;
+  SizeClassPool & operator=(const SizeClassPool &) = delete;
+
+  ~SizeClassPool() { release(); }
+
+  // Alignment is at most that of std::max_align_t.
+  void * allocate(size_t bytes) {
+    size_t k = size_class(bytes);
+    if (k == class_count) return ::operator new(bytes);
+    if (Node * node = free_lists[k]) {
+      free_lists[k] = node->next;
+      return node;
+    }
+    return ::operator new(min_size << k);
+  }
+
+  void deallocate(void * p, size_t bytes) {
+    size_t k = size_class(bytes);
+    if (k == class_count) {
+      ::operator delete(p);
+      return;
+    }
+    Node * node = static_cast<Node *>(p);
+    node->next = free_lists[k];
+    free_lists[k] = node;
+  }
+
+  // Returns every cached block to operator delete.
+  void release() {
+    for (Node *& list : free_lists) {
+      while (list) {
+        Node * next = list->next;
+        ::operator delete(list);
+        list = next;
+      }
+    }
+  }
+};
+
+namespace ssa {
+
+template <typename T>
+size_t allocation_bytes(size_t n) {
+  if (std::numeric_limits<size_t>::max() / sizeof(T) < n) {
+    throw std::bad_alloc();
+  }
+  return n * sizeof(T);
+}
+
+}
+
+// Allocator drawing from a MonotonicArena. Copies, rebound copies and
+// copy-on-write clones all refer to the same arena, and the arena follows
+// the array on assignment and swap.
+template <typename T>
+class ArenaAllocator {
+  template <typename U>
+  friend class ArenaAllocator;
+
+  MonotonicArena * arena;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator(MonotonicArena & arena) noexcept : arena(&arena) { }
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> & o) noexcept : arena(o.arena) { }
+
+  T * allocate(size_t n) {
+    return static_cast<T *>(
+      arena->allocate(ssa::allocation_bytes<T>(n), alignof(T)));
+  }
+
+  void deallocate(T *, size_t) noexcept { }
+
+  MonotonicArena & get_arena() const { return *arena; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> & o) const {
+    return arena == o.arena;
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> & o) const {
+    return !(*this == o);
+  }
+};
+
+// Allocator drawing from a SizeClassPool, with the same propagation rules
+// as ArenaAllocator.
+template <typename T>
+class PoolAllocator {
+  template <typename U>
+  friend class PoolAllocator;
+
+  SizeClassPool * pool;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  PoolAllocator(SizeClassPool & pool) noexcept : pool(&pool) { }
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U> & o) noexcept : pool(o.pool) { }
+
+  T * allocate(size_t n) {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+      "Over-aligned types are not supported");
+    return static_cast<T *>(pool->allocate(ssa::allocation_bytes<T>(n)));
+  }
+
+  void deallocate(T * p, size_t n) noexcept {
+    pool->deallocate(p, n * sizeof(T));
+  }
+
+  SizeClassPool & get_pool() const { return *pool; }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U> & o) const {
+    return pool == o.pool;
+  }
+
+  template <typename U>
+  bool operator!=(const PoolAllocator<U> & o) const {
+    return !(*this == o);
+  }
+};
+
+}
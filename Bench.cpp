@@ -0,0 +1,328 @@
+#include "Allocators.hpp"
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace metaprogramming;
+
+// Micro benchmarks of the hot operations of SymmetricSquareArray, each next
+// to a dense n x n std::vector doing the same work, and of the packed array
+// with different allocators and element types against each other. Every
+// measurement is one tab-separated line: operation, container, rank,
+// nanoseconds per operation (best of several rounds), so runs can be diffed
+// or loaded into a spreadsheet. Not every alternative wins: the pool and
+// the arena do not beat std::allocator on the churn workload, see
+// bench_allocators().
+
+using Value = int64_t;
+using Packed = SymmetricSquareArray<Value>;
+
+// Keeps results alive so the compiler cannot drop the measured work
+volatile Value sink;
+
+// Row-major n x n matrix growing and shrinking in place like the packed
+// array does.
+struct Dense {
+  size_t rank;
+  vector<Value> data;
+
+  explicit Dense(size_t rank) : rank(rank), data(rank * rank) { }
+
+  Value & operator()(size_t row, size_t col) {
+    return data[row * rank + col];
+  }
+
+  const Value & operator()(size_t row, size_t col) const {
+    return data[row * rank + col];
+  }
+
+  void insert(size_t p, Value val) {
+    size_t n = rank + 1;
+    data.resize(n * n);
+    for (size_t r = n; r-- > 0; ) {
+      for (size_t c = n; c-- > 0; ) {
+        if (r == p || c == p) {
+          data[r * n + c] = r == c ? val : Value();
+        } else {
+          data[r * n + c] = data[(r - (p < r)) * rank + c - (p < c)];
+        }
+      }
+    }
+    rank = n;
+  }
+
+  void erase(size_t p) {
+    size_t n = rank - 1;
+    for (size_t r = 0; r < n; ++r) {
+      for (size_t c = 0; c < n; ++c) {
+        data[r * n + c] = data[(r + (p <= r)) * rank + c + (p <= c)];
+      }
+    }
+    data.resize(n * n);
+    rank = n;
+  }
+};
+
+template <typename F>
+double time_once(size_t ops, F f) {
+  using Clock = chrono::steady_clock;
+  auto start = Clock::now();
+  f();
+  chrono::duration<double, nano> elapsed = Clock::now() - start;
+  return elapsed.count() / ops;
+}
+
+const int rounds = 5;
+
+template <typename F>
+double measure(size_t ops, F f) {
+  double best = numeric_limits<double>::max();
+  for (int round = 0; round < rounds; ++round) {
+    best = min(best, time_once(ops, f));
+  }
+  return best;
+}
+
+void report(const char * operation, const char * container, size_t rank,
+    double ns) {
+  cout << operation << '\t' << container << '\t' << rank << '\t' << ns
+    << endl;
+}
+
+Packed make_packed(size_t rank) {
+  return Packed::generate(rank,
+    [](size_t row, size_t col) { return Value(row * 31 + col); });
+}
+
+Dense make_dense(size_t rank) {
+  Dense d(rank);
+  for (size_t r = 0; r < rank; ++r) {
+    for (size_t c = 0; c < rank; ++c) {
+      d(r, c) = Value(max(r, c) * 31 + min(r, c));
+    }
+  }
+  return d;
+}
+
+// Inserts indices and erases them again at the front, middle and back
+template <typename Array>
+void bench_insert_erase(const char * container, Array & a) {
+  size_t rank = a.get_rank();
+  const size_t count = 4;
+  struct Position {
+    const char * name;
+    size_t index;
+  } positions[] = {
+    { "front", 0 }, { "middle", rank / 2 }, { "back", rank }
+  };
+  for (const Position & p : positions) {
+    string insert = string("insert_") + p.name;
+    string erase = string("erase_") + p.name;
+    double insert_ns = numeric_limits<double>::max();
+    double erase_ns = numeric_limits<double>::max();
+    for (int round = 0; round < rounds; ++round) {
+      insert_ns = min(insert_ns, time_once(count, [&] {
+        for (size_t i = 0; i < count; ++i) a.insert(p.index, p.index, 1);
+      }));
+      erase_ns = min(erase_ns, time_once(count, [&] {
+        for (size_t i = 0; i < count; ++i) a.erase(p.index, p.index);
+      }));
+    }
+    report(insert.c_str(), container, rank, insert_ns);
+    report(erase.c_str(), container, rank, erase_ns);
+  }
+}
+
+struct DenseAdapter {
+  Dense & d;
+
+  size_t get_rank() const { return d.rank; }
+  void insert(size_t p, size_t, Value val) { d.insert(p, val); }
+  void erase(size_t p, size_t) { d.erase(p); }
+};
+
+template <typename Array>
+void bench_access(const char * container, const Array & a, size_t rank,
+    const vector<pair<uint32_t, uint32_t>> & cells) {
+  report("random_read", container, rank, measure(cells.size(), [&] {
+    Value sum = 0;
+    for (const auto & cell : cells) sum += a(cell.first, cell.second);
+    sink = sum;
+  }));
+  report("sequential_read", container, rank, measure(rank * rank, [&] {
+    Value sum = 0;
+    for (size_t r = 0; r < rank; ++r) {
+      for (size_t c = 0; c < rank; ++c) sum += a(r, c);
+    }
+    sink = sum;
+  }));
+}
+
+void bench_rank(size_t rank) {
+  Packed packed = make_packed(rank);
+  Dense dense = make_dense(rank);
+  const Packed & packed_view = packed;
+  const Dense & dense_view = dense;
+
+  mt19937 random(rank);
+  vector<pair<uint32_t, uint32_t>> cells(1 << 16);
+  for (auto & cell : cells) {
+    cell = { uint32_t(random() % rank), uint32_t(random() % rank) };
+  }
+  bench_access("packed", packed_view, rank, cells);
+  bench_access("dense", dense_view, rank, cells);
+
+  report("iterate", "packed", rank, measure(rank * rank, [&] {
+    sink = accumulate(packed_view.begin(), packed_view.end(), Value());
+  }));
+  report("iterate", "dense", rank, measure(rank * rank, [&] {
+    sink = accumulate(dense.data.begin(), dense.data.end(), Value());
+  }));
+
+  // A sharable array copies by reference; the first write then pays for
+  // the deep copy. A dense vector always copies eagerly.
+  report("cow_copy", "packed", rank, measure(1, [&] {
+    Packed copy(packed_view);
+    sink = copy.get_reference_count();
+  }));
+  report("cow_unshare", "packed", rank, measure(1, [&] {
+    Packed copy(packed_view);
+    copy(0, 0) = 1;
+    sink = copy.get_reference_count();
+  }));
+  report("copy", "dense", rank, measure(1, [&] {
+    Dense copy(dense_view);
+    copy(0, 0) = 1;
+    sink = copy.data[0];
+  }));
+
+  // Handing out a mutable reference makes the array unsharable, so copies
+  // of it are deep.
+  packed(0, 0) = 0;
+  report("copy_construct", "packed", rank, measure(1, [&] {
+    Packed copy(packed);
+    sink = copy.get_reference_count();
+  }));
+  report("copy_construct", "dense", rank, measure(1, [&] {
+    Dense copy(dense_view);
+    sink = copy.data[0];
+  }));
+
+  packed.reserve(rank + 8);
+  dense.data.reserve((rank + 8) * (rank + 8));
+  DenseAdapter adapter{ dense };
+  bench_insert_erase("packed", packed);
+  bench_insert_erase("dense", adapter);
+}
+
+// Creates short-lived arrays, grows each one index at a time up to rank and
+// erases half of it again, as a workload with many small arrays would.
+// std::allocator goes to malloc for every new buffer; the pool recycles the
+// freed ones and the arena only bumps a pointer until it is released.
+// Neither wins here: moving elements on erase dominates, so the pool stays
+// within noise of std::allocator, and the arena is about 1.2 times slower
+// at rank 16 and 1.6 times at rank 256, because every outgrown buffer stays
+// in it until release() and the working set no longer fits the cache.
+void bench_allocators(size_t rank) {
+  const size_t arrays = 16;
+  const size_t ops = arrays * (rank + rank / 2);
+  auto churn = [&](auto make) {
+    for (size_t k = 0; k < arrays; ++k) {
+      auto a = make();
+      for (size_t i = 0; i < rank; ++i) a.insert(i, i, Value(i));
+      for (size_t i = 0; i < rank / 2; ++i) a.erase(0, 0);
+      sink = a.get_rank();
+    }
+  };
+  report("churn", "std_allocator", rank, measure(ops, [&] {
+    churn([] { return Packed(); });
+  }));
+  SizeClassPool pool;
+  report("churn", "pool", rank, measure(ops, [&] {
+    churn([&] {
+      return SymmetricSquareArray<Value, PoolAllocator<Value>>(pool);
+    });
+  }));
+  MonotonicArena arena;
+  report("churn", "arena", rank, measure(ops, [&] {
+    churn([&] {
+      return SymmetricSquareArray<Value, ArenaAllocator<Value>>(arena);
+    });
+    arena.release();
+  }));
+}
+
+// Value with user-provided copy and move operations. It is not trivially
+// copyable, so arrays of it relocate element by element like before the
+// memcpy path existed, while the bytes moved are the same as for Value.
+struct Boxed {
+  Value value;
+
+  Boxed(Value value = 0) : value(value) { }
+  Boxed(const Boxed & o) noexcept : value(o.value) { }
+  Boxed(Boxed && o) noexcept : value(o.value) { }
+
+  Boxed & operator=(const Boxed & o) noexcept {
+    value = o.value;
+    return *this;
+  }
+
+  Boxed & operator=(Boxed && o) noexcept {
+    value = o.value;
+    return *this;
+  }
+};
+
+// Relocation cost per moved element when the array reallocates, inserts
+// or erases in the middle. The same 8-byte value is moved as raw bytes
+// with memcpy and memmove when it is a plain Value, and one by one through
+// move_if_noexcept and move assignment when it is wrapped in Boxed.
+template <typename T>
+void bench_relocation(const char * container, size_t rank, const T & value) {
+  auto a = SymmetricSquareArray<T>::filled(rank, value);
+  size_t p = rank / 2;
+  size_t size = (rank + 1) * rank / 2;
+  size_t moved = size - (p + 1) * p / 2;
+  double reserve_ns = numeric_limits<double>::max();
+  double insert_ns = numeric_limits<double>::max();
+  double erase_ns = numeric_limits<double>::max();
+  for (int round = 0; round < rounds; ++round) {
+    a.shrink_to_fit();
+    reserve_ns = min(reserve_ns, time_once(size, [&] {
+      a.reserve(rank + 1);
+    }));
+    insert_ns = min(insert_ns, time_once(moved, [&] {
+      a.insert(p, p, value);
+    }));
+    erase_ns = min(erase_ns, time_once(moved, [&] {
+      a.erase(p, p);
+    }));
+  }
+  report("relocate_reserve", container, rank, reserve_ns);
+  report("relocate_insert", container, rank, insert_ns);
+  report("relocate_erase", container, rank, erase_ns);
+}
+
+int main() {
+  cout << fixed << setprecision(1);
+  cout << "operation\tcontainer\trank\tns_per_op" << endl;
+  for (size_t rank : { 64, 512, 2048 }) bench_rank(rank);
+  for (size_t rank : { 16, 64, 256 }) bench_allocators(rank);
+  for (size_t rank : { 64, 512, 1024 }) {
+    bench_relocation("int64_memcpy", rank, Value(1));
+    bench_relocation("int64_per_element", rank, Boxed(1));
+  }
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace metaprogramming {
+
+namespace ssa {
+
+inline size_t popcount(uint64_t word) {
+#if defined(__GNUC__)
+  return __builtin_popcountll(word);
+#else
+  size_t count = 0;
+  for (; word; word &= word - 1) ++count;
+  return count;
+#endif
+}
+
+template <typename Allocator>
+struct BitHolder {
+  using WordAllocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<uint64_t>;
+
+  size_t rank;
+  std::vector<uint64_t, WordAllocator> words;
+
+  BitHolder(size_t rank, Allocator allocator)
+    : rank(rank)
+    , words(((rank + 1) * rank / 2 + 63) / 64, 0,
+        WordAllocator(allocator)) { }
+};
+
+}
+
+// Adjacency matrix of an undirected graph: the packed lower triangle with
+// one bit per cell. Like std::vector<bool> it hands out proxies instead of
+// references, which lets copies stay shared until one of them is written.
+// Rows are extracted a word at a time, so degrees, common neighbours and
+// triangles are counted with AND and popcount. Packing is opt-in through
+// ssa::BitLayout; a plain SymmetricSquareArray<bool> stays a dense array
+// with the full interface.
+template <typename Allocator>
+class SymmetricSquareArray<bool, Allocator, ssa::BitLayout> {
+  using HolderType = ssa::BitHolder<Allocator>;
+  using WordAllocator = typename HolderType::WordAllocator;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  std::shared_ptr<HolderType> holder;
+
+  static size_t sum_n(size_t n) { return (n + 1) * n / 2; }
+
+  static size_t to_linear_index(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    return sum_n(row) + col;
+  }
+
+  static void check_arguments(bool condition) {
+    if (condition) return;
+    throw std::runtime_error("Function was called with wrong arguments");
+  }
+
+  static bool get_bit(const uint64_t * words, size_t i) {
+    return (words[i / 64] >> (i % 64)) & 1;
+  }
+
+  // Reads 64 bits starting at bit i of a buffer of count words.
+  static uint64_t get_word(const uint64_t * words, size_t count, size_t i) {
+    size_t w = i / 64;
+    size_t shift = i % 64;
+    uint64_t result = words[w] >> shift;
+    if (shift && w + 1 < count) result |= words[w + 1] << (64 - shift);
+    return result;
+  }
+
+  void ensure_unique() {
+    if (holder.unique()) return;
+    holder = std::allocate_shared<HolderType>(
+      WordAllocator(get_allocator()), *holder);
+  }
+
+  // Replaces the contents by a triangle of new_rank whose cell (row, col)
+  // is source(row, col).
+  template <typename Source>
+  void rebuild(size_t new_rank, Source source) {
+    auto next = std::allocate_shared<HolderType>(
+      WordAllocator(get_allocator()), new_rank, get_allocator());
+    uint64_t * words = next->words.data();
+    size_t i = 0;
+    for (size_t row = 0; row < new_rank; ++row) {
+      for (size_t col = 0; col <= row; ++col, ++i) {
+        if (source(row, col)) words[i / 64] |= uint64_t(1) << (i % 64);
+      }
+    }
+    holder = std::move(next);
+  }
+
+  // Rebuilds with the old indices at kept (increasing) and new ones, filled
+  // from fill(row, col), everywhere else.
+  template <typename Fill>
+  void remap(size_t new_rank, const std::vector<size_t> & old, Fill fill) {
+    const uint64_t * words = holder->words.data();
+    rebuild(new_rank, [&](size_t row, size_t col) {
+      if (old[row] == npos || old[col] == npos) return fill(row, col);
+      return get_bit(words, to_linear_index(old[row], old[col]));
+    });
+  }
+
+  template <typename Fill>
+  void insert_indices(const std::vector<size_t> & positions, Fill fill) {
+    size_t new_rank = get_rank() + positions.size();
+    for (size_t i = 0; i < positions.size(); ++i) {
+      check_arguments(positions[i] < new_rank
+          && (i == 0 || positions[i - 1] < positions[i]));
+    }
+    std::vector<size_t> old(new_rank, size_t(npos));
+    auto it = positions.begin();
+    for (size_t r = 0, o = 0; r < new_rank; ++r) {
+      if (it != positions.end() && *it == r) ++it;
+      else old[r] = o++;
+    }
+    remap(new_rank, old, fill);
+  }
+
+  void compact(const std::vector<size_t> & kept) {
+    remap(kept.size(), kept, [](size_t, size_t) { return false; });
+  }
+
+public:
+  using allocator_type = Allocator;
+
+  // Proxy for one cell. Writing through it unshares the array first.
+  class Reference {
+    friend class SymmetricSquareArray;
+
+    SymmetricSquareArray * array;
+    size_t row;
+    size_t col;
+
+    Reference(SymmetricSquareArray * array, size_t row, size_t col)
+      : array(array)
+      , row(row)
+      , col(col) { }
+
+  public:
+    operator bool() const {
+      return static_cast<const SymmetricSquareArray &>(*array)(row, col);
+    }
+
+    Reference & operator=(bool value) {
+      array->set(row, col, value);
+      return *this;
+    }
+
+    Reference & operator=(const Reference & o) {
+      return *this = bool(o);
+    }
+
+    void flip() { *this = !bool(*this); }
+  };
+
+  SymmetricSquareArray(Allocator allocator = Allocator())
+    : SymmetricSquareArray(0, allocator) { }
+
+  SymmetricSquareArray(size_t rank, Allocator allocator = Allocator())
+    : holder(
+      std::allocate_shared<HolderType>(
+        WordAllocator(allocator), rank, allocator)) { }
+
+  SymmetricSquareArray(const SymmetricSquareArray &) = default;
+  SymmetricSquareArray(SymmetricSquareArray &&) = default;
+
+  SymmetricSquareArray & operator=(SymmetricSquareArray o) {
+    swap(*this, o);
+    return *this;
+  }
+
+  static void swap(SymmetricSquareArray & lhs, SymmetricSquareArray & rhs) {
+    std::swap(lhs.holder, rhs.holder);
+  }
+
+  bool operator()(size_t row, size_t col) const {
+    return get_bit(holder->words.data(), to_linear_index(row, col));
+  }
+
+  Reference operator()(size_t row, size_t col) {
+    return Reference(this, row, col);
+  }
+
+  void set(size_t row, size_t col, bool value) {
+    ensure_unique();
+    size_t i = to_linear_index(row, col);
+    uint64_t mask = uint64_t(1) << (i % 64);
+    if (value) holder->words[i / 64] |= mask;
+    else       holder->words[i / 64] &= ~mask;
+  }
+
+  void insert(size_t row, size_t col, bool val, bool nil = false) {
+    if (row < col) std::swap(row, col);
+    if (row != col) {
+      insert_indices({ col, row + 1 }, [&](size_t r, size_t c) {
+        return r == row + 1 && c == col ? val : nil;
+      });
+    } else {
+      insert_indices({ row }, [&](size_t r, size_t c) {
+        return r == c ? val : nil;
+      });
+    }
+  }
+
+  void insert_rows(const std::vector<size_t> & positions,
+      bool val, bool nil = false) {
+    insert_indices(positions, [&](size_t r, size_t c) {
+      return r == c ? val : nil;
+    });
+  }
+
+  void erase(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    if (row != col) erase_rows({ col, row });
+    else            erase_rows({ row });
+  }
+
+  void erase_rows(const std::vector<size_t> & indices) {
+    size_t rank = get_rank();
+    for (size_t i = 0; i < indices.size(); ++i) {
+      check_arguments(indices[i] < rank
+          && (i == 0 || indices[i - 1] < indices[i]));
+    }
+    std::vector<size_t> kept;
+    kept.reserve(rank - indices.size());
+    auto it = indices.begin();
+    for (size_t i = 0; i < rank; ++i) {
+      if (it != indices.end() && *it == i) ++it;
+      else kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  template <typename Predicate>
+  void erase_rows_if(Predicate pred) {
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < get_rank(); ++i) {
+      if (!pred(i)) kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  size_t get_rank() const { return holder->rank; }
+
+  Allocator get_allocator() const {
+    return Allocator(holder->words.get_allocator());
+  }
+
+  // Number of words get_row() writes
+  size_t get_row_word_count() const { return (get_rank() + 63) / 64; }
+
+  // Writes row r of the square as a bitset of get_row_word_count() words,
+  // column c at bit c % 64 of word c / 64. Columns up to the diagonal are
+  // copied a word at a time; the ones after it are gathered from the
+  // following packed rows.
+  void get_row(size_t r, uint64_t * out) const {
+    check_arguments(r < get_rank());
+    const uint64_t * words = holder->words.data();
+    size_t count = holder->words.size();
+    size_t row_words = get_row_word_count();
+    size_t begin = sum_n(r);
+    size_t contiguous = r / 64 + 1;
+    for (size_t w = 0; w < contiguous; ++w) {
+      out[w] = get_word(words, count, begin + 64 * w);
+    }
+    if ((r + 1) % 64) {
+      out[contiguous - 1] &= (uint64_t(1) << ((r + 1) % 64)) - 1;
+    }
+    std::fill(out + contiguous, out + row_words, uint64_t(0));
+    for (size_t c = r + 1, i = sum_n(c) + r; c < get_rank(); i += ++c) {
+      out[c / 64] |= uint64_t(get_bit(words, i)) << (c % 64);
+    }
+  }
+
+  // Number of set cells in row r, a self-loop counting once.
+  size_t degree(size_t r) const {
+    check_arguments(r < get_rank());
+    const uint64_t * words = holder->words.data();
+    size_t count = holder->words.size();
+    size_t begin = sum_n(r);
+    size_t result = 0;
+    size_t first = 0;
+    for (; first + 64 <= r + 1; first += 64) {
+      result += ssa::popcount(get_word(words, count, begin + first));
+    }
+    if (first <= r) {
+      uint64_t mask = (uint64_t(1) << (r + 1 - first)) - 1;
+      result += ssa::popcount(get_word(words, count, begin + first) & mask);
+    }
+    for (size_t c = r + 1, i = sum_n(c) + r; c < get_rank(); i += ++c) {
+      result += get_bit(words, i);
+    }
+    return result;
+  }
+
+  // Number of columns k with both (i, k) and (j, k) set.
+  size_t common_neighbors(size_t i, size_t j) const {
+    std::vector<uint64_t> a(get_row_word_count());
+    std::vector<uint64_t> b(get_row_word_count());
+    get_row(i, a.data());
+    get_row(j, b.data());
+    size_t result = 0;
+    for (size_t w = 0; w < a.size(); ++w) result += ssa::popcount(a[w] & b[w]);
+    return result;
+  }
+
+  // Number of triangles, i.e. of triples i > j > k with all three cells
+  // between them set; the diagonal is ignored. Extracts every row once,
+  // which takes rank * rank bits of scratch space, then intersects the rows
+  // of each edge (i, j) below column j.
+  size_t count_triangles() const {
+    size_t rank = get_rank();
+    size_t row_words = get_row_word_count();
+    std::vector<uint64_t> rows(rank * row_words);
+    for (size_t r = 0; r < rank; ++r) get_row(r, rows.data() + r * row_words);
+    const uint64_t * words = holder->words.data();
+    size_t result = 0;
+    for (size_t i = 0; i < rank; ++i) {
+      const uint64_t * a = rows.data() + i * row_words;
+      for (size_t j = 0; j < i; ++j) {
+        if (!get_bit(words, sum_n(i) + j)) continue;
+        const uint64_t * b = rows.data() + j * row_words;
+        size_t w = 0;
+        for (; w < j / 64; ++w) result += ssa::popcount(a[w] & b[w]);
+        if (j % 64) {
+          uint64_t mask = (uint64_t(1) << (j % 64)) - 1;
+          result += ssa::popcount(a[w] & b[w] & mask);
+        }
+      }
+    }
+    return result;
+  }
+
+  long get_reference_count() const { return holder.use_count(); }
+  bool get_is_sharable() const { return true; }
+};
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace metaprogramming {
+
+// Lets many threads update cells of one array concurrently. Constructing it
+// takes the array out of sharing once, so the threads never touch the
+// copy-on-write state. Arithmetic cells the hardware handles lock-free are
+// updated with atomic read-modify-write operations; other types go through
+// striped locks keyed by packed index. The array must not change rank, be copied or be
+// assigned while the updater is in use.
+template <typename ValueType, typename Allocator = std::allocator<ValueType>>
+class ConcurrentUpdater {
+  static constexpr size_t cache_line = 64;
+
+  // Padded to whole cache lines so that neighbouring locks never share one.
+  // The stripes also have to start at a line boundary, but new honours
+  // alignas(64) only from C++17 on, so they are placed by hand in storage.
+  struct Stripe {
+    std::mutex mutex;
+    char padding[cache_line - sizeof(std::mutex) % cache_line];
+  };
+
+  static_assert(sizeof(Stripe) % cache_line == 0, "Stripe is not padded");
+
+#if defined(__GNUC__)
+  // Arithmetic types the hardware updates without a lock. Others, such as
+  // a 16-byte long double, would need libatomic and take the stripes.
+  using IsAtomic = std::integral_constant<bool,
+    std::is_arithmetic<ValueType>::value
+      && __atomic_always_lock_free(sizeof(ValueType), 0)>;
+#else
+  using IsAtomic = std::false_type;
+#endif
+
+  ValueType * data;
+  size_t rank;
+  size_t stripe_count;
+  std::unique_ptr<char[]> storage;
+  Stripe * stripes;
+
+  static size_t to_linear_index(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    return (row + 1) * row / 2 + col;
+  }
+
+  std::mutex & stripe(const ValueType * cell) const {
+    return stripes[(cell - data) % stripe_count].mutex;
+  }
+
+  template <typename F>
+  ValueType update(ValueType * cell, F & fn, std::true_type) {
+    ValueType expected;
+    __atomic_load(cell, &expected, __ATOMIC_RELAXED);
+    for (;;) {
+      ValueType desired = expected;
+      fn(desired);
+      if (__atomic_compare_exchange(cell, &expected, &desired, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return expected;
+      }
+    }
+  }
+
+  // Integers are added by a single atomic instruction
+  ValueType add(ValueType * cell, ValueType delta, std::true_type) {
+    return __atomic_fetch_add(cell, delta, __ATOMIC_RELAXED);
+  }
+
+  // Floating point goes through the compare-exchange loop, everything
+  // else through the stripes
+  ValueType add(ValueType * cell, ValueType delta, std::false_type) {
+    auto add = [&](ValueType & value) { value += delta; };
+    return update(cell, add, IsAtomic());
+  }
+
+  template <typename F>
+  ValueType update(ValueType * cell, F & fn, std::false_type) {
+    std::lock_guard<std::mutex> lock(stripe(cell));
+    ValueType old = *cell;
+    fn(*cell);
+    return old;
+  }
+
+  ValueType load(const ValueType * cell, std::true_type) const {
+    ValueType value;
+    __atomic_load(cell, &value, __ATOMIC_RELAXED);
+    return value;
+  }
+
+  ValueType load(const ValueType * cell, std::false_type) const {
+    std::lock_guard<std::mutex> lock(stripe(cell));
+    return *cell;
+  }
+
+public:
+  explicit ConcurrentUpdater(
+      SymmetricSquareArray<ValueType, Allocator> & array,
+      size_t stripe_count = 64)
+    : data(array.triangle_begin())
+    , rank(array.get_rank())
+    , stripe_count(std::max<size_t>(stripe_count, 1)) {
+    size_t bytes = this->stripe_count * sizeof(Stripe);
+    size_t space = bytes + cache_line;
+    storage.reset(new char[space]);
+    void * begin = storage.get();
+    stripes = static_cast<Stripe *>(
+      std::align(cache_line, bytes, begin, space));
+    for (size_t i = 0; i < this->stripe_count; ++i) new (stripes + i) Stripe;
+  }
+
+  ~ConcurrentUpdater() {
+    for (size_t i = 0; i < stripe_count; ++i) stripes[i].~Stripe();
+  }
+
+  ConcurrentUpdater(const ConcurrentUpdater &) = delete;
+  ConcurrentUpdater & operator=(const ConcurrentUpdater &) = delete;
+
+  // Adds delta to the cell and returns its previous value.
+  ValueType fetch_add(size_t row, size_t col, ValueType delta) {
+    using IsAtomicInteger = std::integral_constant<bool, IsAtomic::value
+      && std::is_integral<ValueType>::value
+      && !std::is_same<ValueType, bool>::value>;
+    return add(data + to_linear_index(row, col), delta, IsAtomicInteger());
+  }
+
+  // Applies fn(value &) to the cell atomically and returns its previous
+  // value. For arithmetic types fn runs on a copy inside a compare-exchange
+  // loop and may therefore be called more than once.
+  template <typename F>
+  ValueType update(size_t row, size_t col, F fn) {
+    return update(data + to_linear_index(row, col), fn, IsAtomic());
+  }
+
+  ValueType load(size_t row, size_t col) const {
+    return load(data + to_linear_index(row, col), IsAtomic());
+  }
+
+  size_t get_rank() const { return rank; }
+};
+
+}
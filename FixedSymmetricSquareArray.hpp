@@ -0,0 +1,132 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+#include "Symv.hpp"
+
+#include <cstddef>
+
+#include <array>
+#include <stdexcept>
+#include <utility>
+
+namespace metaprogramming {
+
+namespace ssa {
+
+// Calls f(0), f(1), ..., f(sizeof...(I) - 1) without a loop.
+template <typename F, size_t... I>
+void unroll(F && f, std::index_sequence<I...>) {
+  int expand[] = { 0, (f(I), 0)... };
+  (void) expand;
+}
+
+template <size_t Count, typename F>
+void unroll(F && f) {
+  unroll(std::forward<F>(f), std::make_index_sequence<Count>());
+}
+
+}
+
+// Symmetric array whose rank is known at compile time. The packed triangle
+// lives inline in a std::array, so there is no holder, no allocation and no
+// sharing: copies are plain value copies. It exposes the same packed
+// triangle as the dynamic array (get_rank, operator(), triangle_begin/end),
+// which is all the kernels in Symv.hpp need.
+template <typename ValueType, size_t N>
+class FixedSymmetricSquareArray {
+public:
+  static constexpr size_t rank = N;
+  static constexpr size_t size = (N + 1) * N / 2;
+
+  static constexpr size_t to_linear_index(size_t row, size_t col) {
+    return row < col
+      ? (col + 1) * col / 2 + row
+      : (row + 1) * row / 2 + col;
+  }
+
+private:
+  std::array<ValueType, size> data;
+
+  static void check_arguments(bool condition) {
+    if (condition) return;
+    throw std::runtime_error("Function was called with wrong arguments");
+  }
+
+public:
+  constexpr FixedSymmetricSquareArray() : data{} { }
+
+  explicit FixedSymmetricSquareArray(const ValueType & value) {
+    ssa::unroll<size>([&](size_t i) { data[i] = value; });
+  }
+
+  template <typename Allocator>
+  explicit FixedSymmetricSquareArray(
+      const SymmetricSquareArray<ValueType, Allocator> & array) {
+    check_arguments(array.get_rank() == N);
+    const ValueType * it = array.triangle_begin();
+    ssa::unroll<size>([&](size_t i) { data[i] = it[i]; });
+  }
+
+  // Copies the contents into a dynamic array.
+  template <typename Allocator = std::allocator<ValueType>>
+  SymmetricSquareArray<ValueType, Allocator> to_array(
+      Allocator allocator = Allocator()) const {
+    return SymmetricSquareArray<ValueType, Allocator>::from_function(N,
+      [&](size_t row, size_t col) -> const ValueType & {
+        return data[(row + 1) * row / 2 + col];
+      },
+      allocator);
+  }
+
+  constexpr const ValueType & operator()(size_t row, size_t col) const {
+    return data[to_linear_index(row, col)];
+  }
+
+  ValueType & operator()(size_t row, size_t col) {
+    return data[to_linear_index(row, col)];
+  }
+
+  static constexpr size_t get_rank() { return N; }
+
+  ValueType * triangle_begin() { return data.data(); }
+  ValueType * triangle_end() { return data.data() + size; }
+
+  const ValueType * triangle_begin() const { return data.data(); }
+  const ValueType * triangle_end() const { return data.data() + size; }
+
+  // Replaces every stored element by f(element).
+  template <typename F>
+  void transform(F f) {
+    ssa::unroll<size>([&](size_t i) { data[i] = f(data[i]); });
+  }
+
+  // y = alpha * A * x + beta * y with the scalar kernel, whose loops have
+  // constant trip counts here and are unrolled by the compiler.
+  void symv(const ValueType * x, ValueType * y,
+      ValueType alpha = ValueType(1),
+      ValueType beta = ValueType(0)) const {
+    ssa::scale(N, y, beta);
+    ssa::symv_scalar(0, N, data.data(), x, y, alpha);
+  }
+
+  bool operator==(const FixedSymmetricSquareArray & o) const {
+    return data == o.data;
+  }
+
+  bool operator!=(const FixedSymmetricSquareArray & o) const {
+    return !(*this == o);
+  }
+
+  static void swap(FixedSymmetricSquareArray & lhs,
+      FixedSymmetricSquareArray & rhs) {
+    std::swap(lhs.data, rhs.data);
+  }
+};
+
+template <typename ValueType, size_t N>
+constexpr size_t FixedSymmetricSquareArray<ValueType, N>::rank;
+
+template <typename ValueType, size_t N>
+constexpr size_t FixedSymmetricSquareArray<ValueType, N>::size;
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if defined(__linux__)
+#define SSA_LINUX_PAGES 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace metaprogramming {
+
+// Where the pages of a mapping are placed on a NUMA machine. With
+// first_touch every page lands on the node of the thread that writes it
+// first, which pays off when the array is built with generate() on the
+// same pool that later processes it, since both split rows the same way.
+// interleave spreads the pages round-robin over every allowed node, which
+// balances bandwidth for passes that no single node owns.
+enum class NumaPolicy { first_touch, interleave };
+
+namespace ssa {
+
+constexpr size_t huge_page_size = size_t(2) << 20;
+
+// Requests below this size are too small to be worth a mapping of their own
+constexpr size_t huge_page_threshold = huge_page_size / 2;
+
+inline size_t round_to_huge_pages(size_t bytes) {
+  return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+}
+
+#ifdef SSA_LINUX_PAGES
+
+// Best effort: without NUMA support the calls fail and nothing changes.
+inline void interleave_pages(void * p, size_t bytes) {
+#if defined(SYS_get_mempolicy) && defined(SYS_mbind)
+  const int mpol_interleave = 3;
+  const unsigned long mpol_f_mems_allowed = 1 << 2;
+  const unsigned long max_node = 1024;
+  unsigned long nodes[max_node / (8 * sizeof(unsigned long))] = { };
+  if (syscall(SYS_get_mempolicy, nullptr, nodes, max_node, nullptr,
+        mpol_f_mems_allowed) != 0) {
+    return;
+  }
+  syscall(SYS_mbind, p, bytes, mpol_interleave, nodes, max_node, 0);
+#else
+  (void) p;
+  (void) bytes;
+#endif
+}
+
+// Maps whole huge pages aligned to their size, so that transparent huge
+// pages can back all of them. Nothing is touched here.
+inline void * map_huge_pages(size_t bytes, NumaPolicy policy) {
+  size_t size = round_to_huge_pages(bytes);
+  void * mapping = mmap(nullptr, size + huge_page_size,
+    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) throw std::bad_alloc();
+  uintptr_t begin = reinterpret_cast<uintptr_t>(mapping);
+  uintptr_t aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+  if (aligned != begin) {
+    munmap(mapping, aligned - begin);
+  }
+  if (size_t tail = begin + huge_page_size - aligned) {
+    munmap(reinterpret_cast<void *>(aligned + size), tail);
+  }
+  void * p = reinterpret_cast<void *>(aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(p, size, MADV_HUGEPAGE);
+#endif
+  if (policy == NumaPolicy::interleave) interleave_pages(p, size);
+  return p;
+}
+
+inline void unmap_huge_pages(void * p, size_t bytes) {
+  munmap(p, round_to_huge_pages(bytes));
+}
+
+#else
+
+inline void * map_huge_pages(size_t bytes, NumaPolicy) {
+  return ::operator new(bytes);
+}
+
+inline void unmap_huge_pages(void * p, size_t) { ::operator delete(p); }
+
+#endif
+
+}
+
+// Allocator for very large arrays. Big buffers get their own mapping of
+// transparent huge pages, which cuts TLB misses in full-matrix passes, and
+// are placed on NUMA nodes according to the policy. Small requests, such
+// as the holder of the array, go through operator new. Only Linux maps huge
+// pages; elsewhere everything goes through operator new.
+template <typename T>
+class HugePageAllocator {
+  template <typename U>
+  friend class HugePageAllocator;
+
+  NumaPolicy policy;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  HugePageAllocator(NumaPolicy policy = NumaPolicy::first_touch) noexcept
+    : policy(policy) { }
+
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U> & o) noexcept
+    : policy(o.policy) { }
+
+  T * allocate(size_t n) {
+    if (std::numeric_limits<size_t>::max() / sizeof(T) < n) {
+      throw std::bad_alloc();
+    }
+    size_t bytes = n * sizeof(T);
+    if (bytes < ssa::huge_page_threshold) {
+      return static_cast<T *>(::operator new(bytes));
+    }
+    return static_cast<T *>(ssa::map_huge_pages(bytes, policy));
+  }
+
+  void deallocate(T * p, size_t n) noexcept {
+    size_t bytes = n * sizeof(T);
+    if (bytes < ssa::huge_page_threshold) ::operator delete(p);
+    else ssa::unmap_huge_pages(p, bytes);
+  }
+
+  NumaPolicy get_policy() const { return policy; }
+
+  // Any instance can free what another one allocated.
+  template <typename U>
+  bool operator==(const HugePageAllocator<U> &) const { return true; }
+
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
+
+}
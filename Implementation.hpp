@@ -1,25 +1,67 @@
 #pragma once
 
+#include "Statistics.hpp"
+
 #include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 
+#include <algorithm>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <stdexcept>
 #include <type_traits>
+#include <vector>
 
 namespace metaprogramming {
 
 namespace ssa {
 
+// Greatest rank whose triangle is kept inside the array object itself, so
+// that small arrays need no separate allocation. Specialize it to tune the
+// trade-off for a type; 0 disables inline storage.
+template <typename ValueType>
+struct InlineRank : std::integral_constant<size_t,
+  sizeof(ValueType) <= sizeof(double) ? 4 : 0> { };
+
+template <typename ValueType, size_t Capacity>
+struct InlineBuffer {
+  typename std::aligned_storage<sizeof(ValueType), alignof(ValueType)>::type
+    elements[Capacity];
+
+  ValueType * get() { return reinterpret_cast<ValueType *>(elements); }
+
+  const ValueType * get() const {
+    return reinterpret_cast<const ValueType *>(elements);
+  }
+};
+
+template <typename ValueType>
+struct InlineBuffer<ValueType, 0> {
+  ValueType * get() const { return nullptr; }
+};
+
 template <typename ValueType, typename Allocator>
-class Implementation {
+class Implementation : private Counters {
+  using AllocatorTraits = std::allocator_traits<Allocator>;
+
+  static constexpr size_t inline_capacity =
+    (InlineRank<ValueType>::value + 1) * InlineRank<ValueType>::value / 2;
+
   size_t rank;
   size_t size;
   size_t capacity;
   Allocator allocator;
+  InlineBuffer<ValueType, inline_capacity> buffer;
   ValueType * data;
 
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  // Side of the square tiles in which permute() gathers the cells
+  static constexpr size_t permute_tile = 32;
+
   // Returns sum of first n natural numbers
   static size_t sum_n(size_t n) {
     return (n + 1) * n / 2;
@@ -29,8 +71,16 @@ class Implementation {
     return sum_n(rank);
   }
 
+  // Returns the greatest rank whose triangle fits into size elements
+  static size_t calculate_rank(size_t size) {
+    size_t rank = (std::sqrt(8.0 * size + 1) - 1) / 2;
+    while (size < calculate_size(rank)) --rank;
+    while (calculate_size(rank + 1) <= size) ++rank;
+    return rank;
+  }
+
   static size_t to_linear_index(size_t row, size_t col) {
-    return col > row ? to_linear_index(col, row) : sum_n(row) + col;
+    return col > row ? sum_n(col) + row : sum_n(row) + col;
   }
 
   static void check_arguments(bool condition) {
@@ -38,185 +88,666 @@ class Implementation {
     throw std::runtime_error("Function was called with wrong arguments");
   }
 
+  // Elements of trivially copyable types are relocated as raw bytes and
+  // never need to be destroyed.
+  using IsTrivial = std::is_trivially_copyable<ValueType>;
+
+  // Whether relocating an element leaves a moved-from one behind, in which
+  // case it has to be moved back if the operation fails halfway.
+  using IsRelocatedByMove = std::integral_constant<bool,
+    !IsTrivial::value && std::is_nothrow_move_constructible<ValueType>::value>;
+
+  // Whether rows can be shifted in place without an assignment throwing
+  // halfway, which would leave them neither shifted nor as they were.
+  using IsShiftedInPlace = std::integral_constant<bool,
+    std::is_nothrow_move_assignable<ValueType>::value
+      && std::is_nothrow_copy_assignable<ValueType>::value>;
+
+  static std::conditional_t<
+    std::is_nothrow_move_assignable<ValueType>::value,
+    ValueType &&,
+    const ValueType &>
+  move_assign_if_noexcept(ValueType & x) {
+    return std::move(x);
+  }
+
+  static void destroy(ValueType *, ValueType *, std::true_type) { }
+
+  static void destroy(ValueType * begin, ValueType * end, std::false_type) {
+    for (; begin != end; ++begin) begin->~ValueType();
+  }
+
+  static void destroy(ValueType * begin, ValueType * end) {
+    destroy(begin, end, std::is_trivially_destructible<ValueType>());
+  }
+
+  // Constructs count elements at it from source, advancing it past every
+  // element constructed so far even if one of them throws.
+  static void construct_run(ValueType *& it, ValueType * source,
+      size_t count, std::true_type) {
+    if (count == 0) return;
+    std::memcpy(it, source, count * sizeof(ValueType));
+    it += count;
+  }
+
+  static void construct_run(ValueType *& it, ValueType * source,
+      size_t count, std::false_type) {
+    for (size_t i = 0; i < count; ++i, ++it) {
+      new (it) ValueType(std::move_if_noexcept(source[i]));
+    }
+  }
+
+  static void assign_run(ValueType * target, ValueType * source,
+      size_t count, std::true_type) {
+    std::memmove(target, source, count * sizeof(ValueType));
+  }
+
+  static void assign_run(ValueType * target, ValueType * source,
+      size_t count, std::false_type) {
+    for (size_t i = 0; i < count; ++i) {
+      target[i] = move_assign_if_noexcept(source[i]);
+    }
+  }
+
   static void
   uninitialized_default_construct(ValueType * begin, ValueType * end) {
     ValueType * current = begin;
     try {
       for (; current != end; ++current) new (current) ValueType();
     } catch (...) {
-      for (; begin != current; ++begin) begin->~ValueType();
+      destroy(begin, current);
+      throw;
+    }
+  }
+
+  // Splits row r of the triangle that results from inserting indices at the
+  // sorted positions [begin, end) into runs of old columns and new cells.
+  // Calls run(col, old_col, count) and cell(col) in column order.
+  template <typename Run, typename Cell>
+  static void split_row(const size_t * begin, const size_t * end, size_t r,
+      Run run, Cell cell) {
+    size_t c = 0;
+    size_t old = 0;
+    for (; begin != end && *begin <= r; ++begin) {
+      if (c < *begin) run(c, old, *begin - c);
+      old += *begin - c;
+      cell(*begin);
+      c = *begin + 1;
+    }
+    if (c <= r) run(c, old, r + 1 - c);
+  }
+
+  // Keeps only the given (increasing) indices, moving every surviving
+  // element forward at most once and destroying the tail afterwards.
+  void compact(const std::vector<size_t> & kept) {
+    size_t new_rank = kept.size();
+    size_t new_size = calculate_size(new_rank);
+    size_t first = 0;
+    while (first < new_rank && kept[first] == first) ++first;
+    if (first == rank) return;
+    ValueType * it = data + calculate_size(first);
+    for (size_t r = first; r < new_rank; ++r) {
+      ValueType * source = data + calculate_size(kept[r]);
+      for (size_t c = 0; c <= r;) {
+        size_t n = 1;
+        while (c + n <= r && kept[c + n] == kept[c] + n) ++n;
+        assign_run(it, source + kept[c], n, IsTrivial());
+        it += n;
+        c += n;
+      }
+    }
+    destroy(data + new_size, data + size);
+    record(Counter::elements_moved, new_size - calculate_size(first));
+    record(Counter::elements_destroyed, size - new_size);
+    rank = new_rank;
+    size = new_size;
+  }
+
+  void check_permutation(const std::vector<size_t> & perm) const {
+    check_arguments(perm.size() == rank);
+    std::vector<bool> seen(rank);
+    for (size_t p : perm) {
+      check_arguments(p < rank && !seen[p]);
+      seen[p] = true;
+    }
+  }
+
+  // Constructs the triangle reordered by perm in the raw buffer target by
+  // make(cell, old cell). Cell (r, c) comes from old cell (perm[r],
+  // perm[c]), which lies in old row perm[c] whenever perm[r] < perm[c], so
+  // a walk along the new rows would pick every cell from a different part
+  // of the old triangle. The cells are made in square tiles of new rows and
+  // columns instead, each of which reads from at most 2 * permute_tile old
+  // rows. If make throws, the elements made so far are destroyed again.
+  template <typename Make>
+  void construct_permuted(ValueType * target,
+      const std::vector<size_t> & perm, Make make) const {
+    std::vector<ValueType *> old_row(rank);
+    for (size_t o = 0; o < rank; ++o) old_row[o] = data + calculate_size(o);
+    // Calls visit(cell, r, c) tile by tile until it returns false
+    auto for_each_cell = [&](auto visit) {
+      for (size_t r0 = 0; r0 < rank; r0 += permute_tile) {
+        size_t r1 = std::min(rank, r0 + permute_tile);
+        for (size_t c0 = 0; c0 <= r0; c0 += permute_tile) {
+          for (size_t r = r0; r < r1; ++r) {
+            ValueType * it = target + calculate_size(r);
+            size_t c1 = std::min(r + 1, c0 + permute_tile);
+            for (size_t c = c0; c < c1; ++c) {
+              if (!visit(it + c, r, c)) return;
+            }
+          }
+        }
+      }
+    };
+    size_t made = 0;
+    try {
+      for_each_cell([&](ValueType * it, size_t r, size_t c) {
+        size_t o = perm[r];
+        size_t p = perm[c];
+        make(it, p <= o ? old_row[o] + p : old_row[p] + o);
+        ++made;
+        return true;
+      });
+    } catch (...) {
+      for_each_cell([&](ValueType * it, size_t, size_t) {
+        if (made == 0) return false;
+        --made;
+        destroy(it, it + 1);
+        return true;
+      });
       throw;
     }
   }
 
+  // Inserts new indices at the sorted positions [begin, end) of the
+  // resulting array in a single pass. Cells in the new rows and columns are
+  // copied from fill(row, col).
+  template <typename Fill>
+  void insert_indices(const size_t * begin, const size_t * end, Fill fill) {
+    size_t count = end - begin;
+    if (count == 0) return;
+    size_t new_rank = rank + count;
+    size_t new_size = calculate_size(new_rank);
+    for (const size_t * p = begin; p != end; ++p) {
+      check_arguments(*p < new_rank && (p == begin || p[-1] < *p));
+    }
+    // Returns the old row that ends up at r or npos for a new one
+    auto origin = [&](size_t r) {
+      const size_t * p = std::upper_bound(begin, end, r);
+      return p != begin && p[-1] == r ? npos : r - (p - begin);
+    };
+    // Constructs rows [first, last) of the result at target. If that throws,
+    // whatever was moved out of the old rows is moved back.
+    auto build_rows = [&](ValueType * target, size_t first, size_t last) {
+      ValueType * it = target;
+      try {
+        for (size_t r = first; r < last; ++r) {
+          size_t o = origin(r);
+          if (o == npos) {
+            for (size_t c = 0; c <= r; ++c, ++it) new (it) ValueType(fill(r, c));
+            continue;
+          }
+          ValueType * source = data + calculate_size(o);
+          split_row(begin, end, r,
+            [&](size_t, size_t old, size_t n) {
+              construct_run(it, source + old, n, IsTrivial());
+            },
+            [&](size_t c) {
+              new (it) ValueType(fill(r, c));
+              ++it;
+            });
+        }
+      } catch (...) {
+        ValueType * built = it;
+        if (IsRelocatedByMove::value) {
+          it = target;
+          for (size_t r = first; it != built; ++r) {
+            size_t o = origin(r);
+            if (o == npos) {
+              it += std::min<size_t>(r + 1, built - it);
+              continue;
+            }
+            ValueType * source = data + calculate_size(o);
+            split_row(begin, end, r,
+              [&](size_t, size_t old, size_t n) {
+                for (size_t i = 0; i < n && it != built; ++i, ++it) {
+                  source[old + i].~ValueType();
+                  new (source + old + i) ValueType(std::move(*it));
+                }
+              },
+              [&](size_t) { if (it != built) ++it; });
+          }
+        }
+        destroy(target, built);
+        throw;
+      }
+    };
+    if (new_size <= capacity && IsShiftedInPlace::value) {
+      // Rows past the old rank land in raw memory. Build them first, which
+      // either succeeds or leaves the array as it was, then shift the rows
+      // in-between backwards by assignment, which cannot throw. Every row
+      // only reads from rows above it, so walking down never reads an
+      // overwritten element. Types whose assignment may throw take the
+      // reallocating path below, which keeps the strong guarantee.
+      build_rows(data + size, rank, new_rank);
+      for (size_t r = rank - 1; *begin <= r && r < rank; --r) {
+        ValueType * target = data + calculate_size(r);
+        size_t o = origin(r);
+        if (o == npos) {
+          for (size_t c = 0; c <= r; ++c) target[c] = fill(r, c);
+          continue;
+        }
+        ValueType * source = data + calculate_size(o);
+        split_row(begin, end, r,
+          [&](size_t c, size_t old, size_t n) {
+            assign_run(target + c, source + old, n, IsTrivial());
+          },
+          [&](size_t c) { target[c] = fill(r, c); });
+      }
+      record(Counter::elements_moved, size - calculate_size(*begin));
+    } else if (new_size <= capacity && is_inline()) {
+      // The result would land in the same inline buffer, so build it in a
+      // scratch one and relocate it back. Relocating only throws if moves
+      // may throw, and then the array is left empty.
+      InlineBuffer<ValueType, inline_capacity> scratch;
+      ValueType * built = scratch.get();
+      build_rows(built, 0, new_rank);
+      destroy(data, data + size);
+      ValueType * it = data;
+      try {
+        construct_run(it, built, new_size, IsTrivial());
+      } catch (...) {
+        destroy(data, it);
+        destroy(built, built + new_size);
+        rank = 0;
+        size = 0;
+        throw;
+      }
+      destroy(built, built + new_size);
+      record(Counter::elements_moved, size);
+    } else {
+      size_t new_capacity = new_size <= capacity
+        ? capacity
+        : std::max(new_size, 2 * capacity);
+      ValueType * new_data = allocate(new_capacity);
+      try {
+        build_rows(new_data, 0, new_rank);
+      } catch (...) {
+        deallocate(new_data, new_capacity);
+        throw;
+      }
+      destroy(data, data + size);
+      deallocate(data, capacity);
+      data = new_data;
+      capacity = new_capacity;
+      record(Counter::elements_moved, size);
+    }
+    record(Counter::elements_constructed, new_size - size);
+    size = new_size;
+    rank = new_rank;
+  }
+
+  // Whether x refers to one of the stored elements, which would be
+  // overwritten while being inserted.
+  bool contains(const ValueType & x) const {
+    return std::less_equal<const ValueType *>()(data, &x)
+      && std::less<const ValueType *>()(&x, data + size);
+  }
+
+  bool is_inline() const { return data == buffer.get(); }
+
+  // Storage for at least capacity elements: the inline buffer if it is big
+  // enough, in which case capacity is raised to its size, or the heap.
+  ValueType * allocate(size_t & capacity) {
+    if (capacity <= inline_capacity) {
+      capacity = inline_capacity;
+      return buffer.get();
+    }
+    ValueType * p = AllocatorTraits::allocate(allocator, capacity);
+    record(Counter::allocations);
+    record(Counter::bytes_allocated, capacity * sizeof(ValueType));
+    return p;
+  }
+
+  void deallocate(ValueType * p, size_t capacity) {
+    if (p != buffer.get()) {
+      AllocatorTraits::deallocate(allocator, p, capacity);
+    }
+  }
+
+  // Allocators that do not propagate on swap compare equal here, so they
+  // can stay where they are.
+  static void swap_allocators(Implementation & lhs, Implementation & rhs,
+      std::true_type) {
+    std::swap(lhs.allocator, rhs.allocator);
+  }
+
+  static void swap_allocators(Implementation &, Implementation &,
+      std::false_type) { }
+
+  void reallocate(size_t new_capacity) {
+    assert(size <= new_capacity);
+    ValueType * new_data = allocate(new_capacity);
+    assert(new_data != data);
+    ValueType * it = new_data;
+    try {
+      construct_run(it, data, size, IsTrivial());
+    } catch (...) {
+      destroy(new_data, it);
+      deallocate(new_data, new_capacity);
+      throw;
+    }
+    destroy(data, data + size);
+    deallocate(data, capacity);
+    data = new_data;
+    capacity = new_capacity;
+    record(Counter::elements_moved, size);
+  }
+
+  // Moves the contents of o into this empty array and leaves o empty. If
+  // propagate is set, this array takes over the allocator of o. Heap
+  // storage changes hands if the allocators then compare equal; otherwise,
+  // and for inline elements, the elements are relocated one by one into
+  // storage from this array's allocator.
+  void take(Implementation & o, bool propagate) {
+    assert(size == 0 && is_inline());
+    if (propagate) allocator = o.allocator;
+    Counters::swap(*this, o);
+    if (o.is_inline() || !(allocator == o.allocator)) {
+      size_t new_capacity = o.size;
+      ValueType * new_data = allocate(new_capacity);
+      ValueType * it = new_data;
+      try {
+        construct_run(it, o.data, o.size, IsTrivial());
+      } catch (...) {
+        destroy(new_data, it);
+        deallocate(new_data, new_capacity);
+        throw;
+      }
+      destroy(o.data, o.data + o.size);
+      o.deallocate(o.data, o.capacity);
+      o.data = o.buffer.get();
+      o.capacity = inline_capacity;
+      data = new_data;
+      capacity = new_capacity;
+      record(Counter::elements_moved, o.size);
+    } else {
+      data = o.data;
+      capacity = o.capacity;
+      o.data = o.buffer.get();
+      o.capacity = inline_capacity;
+    }
+    rank = o.rank;
+    size = o.size;
+    o.rank = 0;
+    o.size = 0;
+  }
+
+  // Replaces the contents by those of o, which is left empty. The elements
+  // of o are relocated first if they have to be, so a throw leaves this
+  // array as it was, except that inline elements only get the basic
+  // guarantee, as in swap().
+  void replace(Implementation & o, bool propagate) {
+    Implementation result(propagate ? o.allocator : allocator);
+    result.take(o, false);
+    destroy(data, data + size);
+    deallocate(data, capacity);
+    record(Counter::elements_destroyed, size);
+    data = buffer.get();
+    capacity = inline_capacity;
+    rank = 0;
+    size = 0;
+    take(result, true);
+  }
+
 public:
   Implementation(Allocator allocator = Allocator())
       : rank(0)
       , size(0)
-      , capacity(0)
-      , allocator(allocator)
-      , data(nullptr) { }
+      , capacity(inline_capacity)
+      , allocator(allocator) {
+    data = buffer.get();
+  }
 
   Implementation(size_t rank, Allocator allocator = Allocator())
       : rank(rank)
       , size(calculate_size(rank))
       , capacity(size)
       , allocator(allocator)
-      , data(allocator.allocate(size)) {
+      , data(allocate(capacity)) {
     uninitialized_default_construct(data, data + size);
+    record(Counter::elements_constructed, size);
+  }
+
+  // Takes over a buffer of capacity elements obtained from allocator whose
+  // beginning already holds the triangle of the given rank.
+  Implementation(size_t rank, size_t capacity, ValueType * data,
+      Allocator allocator)
+      : rank(rank)
+      , size(calculate_size(rank))
+      , capacity(capacity)
+      , allocator(allocator)
+      , data(data) {
+    assert(size <= capacity);
+  }
+
+  // Lets build(data) construct every element of the raw triangle in place.
+  // If it throws it has to destroy whatever it constructed.
+  template <typename Build>
+  Implementation(size_t rank, Build build, Allocator allocator)
+      : rank(rank)
+      , size(calculate_size(rank))
+      , capacity(size)
+      , allocator(allocator)
+      , data(allocate(capacity)) {
+    try {
+      build(data);
+    } catch (...) {
+      deallocate(data, capacity);
+      throw;
+    }
+    record(Counter::elements_constructed, size);
   }
 
   Implementation(const Implementation & o)
-      : rank(o.rank)
+      : Counters(o)
+      , rank(o.rank)
+      , size(o.size)
+      , capacity(o.size)
+      , allocator(
+        AllocatorTraits::select_on_container_copy_construction(o.allocator))
+      , data(allocate(capacity)) {
+    try {
+      std::uninitialized_copy(o.data, o.data + o.size, data);
+    } catch (...) {
+      deallocate(data, capacity);
+      throw;
+    }
+    record(Counter::elements_copied, size);
+  }
+
+  // Copy of o with its indices reordered as by permute(perm), gathered
+  // straight from o, so that a shared triangle is copied only once.
+  Implementation(const Implementation & o, const std::vector<size_t> & perm)
+      : Counters(o)
+      , rank(o.rank)
       , size(o.size)
       , capacity(o.size)
-      , allocator(o.allocator)
-      , data(allocator.allocate(size)) {
-    std::uninitialized_copy(o.data, o.data + o.size, data);
+      , allocator(
+        AllocatorTraits::select_on_container_copy_construction(o.allocator))
+      , data(allocate(capacity)) {
+    try {
+      o.check_permutation(perm);
+      o.construct_permuted(data, perm,
+        [](ValueType * target, const ValueType * source) {
+          new (target) ValueType(*source);
+        });
+    } catch (...) {
+      deallocate(data, capacity);
+      throw;
+    }
+    record(Counter::elements_copied, size);
   }
 
   Implementation(Implementation && o)
-      : Implementation() {
-    swap(*this, o);
+      : Implementation(o.allocator) {
+    take(o, true);
   }
 
   ~Implementation() {
-    for (size_t i = 0; i < size; ++i) data[i].~ValueType();
-    allocator.deallocate(data, capacity);
+    destroy(data, data + size);
+    deallocate(data, capacity);
+    record(Counter::elements_destroyed, size);
   }
 
   void insert(size_t row, size_t col, const ValueType & val,
       const ValueType & nil = ValueType()) {
-    using namespace std;
-    if (col != row) {
+    if (contains(val) || contains(nil)) {
+      ValueType val_copy(val);
+      ValueType nil_copy(nil);
+      insert(row, col, val_copy, nil_copy);
+    } else if (col != row) {
       if (row < col) std::swap(row, col);
-      insert(row, row, nil, nil);
-      insert(col, col, nil, nil);
-      (*this)(row + 1, col) = val;
+      // Same as inserting (row, row) and then (col, col), which pushes the
+      // former to row + 1, but done in one pass.
+      size_t positions[] = { col, row + 1 };
+      insert_indices(positions, positions + 2,
+        [&](size_t r, size_t c) -> const ValueType & {
+          return r == row + 1 && c == col ? val : nil;
+        });
     } else {
-      check_arguments(row <= rank && col <= rank);
-      size_t new_rank = rank + 1;
-      size_t new_size = size + new_rank;
-      if (new_size <= capacity) {
-        ValueType * end = &data[new_rank * (new_rank + 1) / 2];
-        ValueType * it = end - 1;
-        size_t cc; // Number of Constructed Columns in last row
-                   // We handle deletion here and not in destructor as
-                   // destructor only aware of rows that are whole
-                   // constructed.
-        try {
-          if (row == rank) { // col == rank as well
-            cc = 0;
-            new (it--) ValueType(val);
-            for (cc = 1; cc < new_rank; ++cc) {
-              new (it--) ValueType(nil);
-            }
-          } else {
-            for (cc = 0; cc < new_rank; ++cc) {
-              if (cc < col) {
-                new (it) ValueType(data[to_linear_index(new_rank - 2, cc)]);
-              } else if (cc == col) {
-                new (it) ValueType(nil);
-              } else {
-                new (it) ValueType(data[to_linear_index(new_rank - 2, cc - 1)]);
-              }
-              --it;
-            }
-          }
-          for (size_t r = new_rank - 2; r <= new_rank; --r) {
-            for (size_t c = r; c <= r; --c) {
-              if (r < row) return;
-              if (r == row) {
-                if (c < row) *it = nil;
-                else         *it = val;
-              } else if (r + 1 < new_rank) {
-                if (c < row) {
-                  *it = data[to_linear_index(r - 1, c)];
-                } else if (c == row) {
-                  *it = nil;
-                } else {
-                  *it = data[to_linear_index(r - 1, c - 1)];
-                }
-              }
-              --it;
-            }
-          }
-        } catch (...) {
-          it = end - cc;
-          for (size_t i = 0; i < cc; ++i, ++it) it->~ValueType();
-          throw;
-        }
-      } else {
-        ValueType * new_data = allocator.allocate(new_size);
-        ValueType * end = &new_data[new_rank * (new_rank + 1) / 2];
-        ValueType * it = end - 1;
-        try {
-          for (size_t r = new_rank - 1; r < new_rank; --r) {
-            for (size_t c = r; c <= r; --c) {
-              if (r < row) {
-                new (it) ValueType(data[to_linear_index(r, c)]);
-              } else if (r == row) {
-                new (it) ValueType(c < row ? nil : val);
-              } else {
-                if (c < row) {
-                  new (it) ValueType(data[to_linear_index(r - 1, c)]);
-                } else if (c == row) {
-                  new (it) ValueType(nil);
-                } else {
-                  new (it) ValueType(data[to_linear_index(r - 1, c - 1)]);
-                }
-              }
-              --it;
-            }
-          }
-        } catch (...) {
-          ++it;
-          while (it != end) {
-            it->~ValueType();
-            ++it;
-          }
-          allocator.deallocate(new_data, new_size);
-          throw;
-        }
-        for (size_t i = 0; i < size; ++i) data[i].~ValueType();
-        allocator.deallocate(data, size);
-        data = new_data;
-        capacity = new_size;
-      }
-      size = new_size;
-      rank = new_rank;
+      insert_indices(&row, &row + 1,
+        [&](size_t r, size_t c) -> const ValueType & {
+          return r == c ? val : nil;
+        });
     }
   }
 
+  // Inserts a new index at every one of the given positions. Positions refer
+  // to the resulting array and must be strictly increasing, so the result is
+  // the same as inserting them one by one in that order, except that every
+  // existing element is moved only once and at most one reallocation occurs.
+  void insert_rows(const std::vector<size_t> & positions,
+      const ValueType & val, const ValueType & nil = ValueType()) {
+    if (contains(val) || contains(nil)) {
+      ValueType val_copy(val);
+      ValueType nil_copy(nil);
+      insert_rows(positions, val_copy, nil_copy);
+      return;
+    }
+    insert_indices(positions.data(), positions.data() + positions.size(),
+      [&](size_t r, size_t c) -> const ValueType & {
+        return r == c ? val : nil;
+      });
+  }
+
   void erase(size_t row, size_t col) {
-    if (row != col) {
-      if (row < col) std::swap(row, col);
-      erase(row, row);
-      erase(col, col);
+    if (row < col) std::swap(row, col);
+    if (row != col) erase_rows({ col, row });
+    else            erase_rows({ row });
+  }
+
+  // Erases every index of a strictly increasing set in a single forward
+  // sweep over the triangle.
+  void erase_rows(const std::vector<size_t> & indices) {
+    for (size_t i = 0; i < indices.size(); ++i) {
+      check_arguments(indices[i] < rank
+          && (i == 0 || indices[i - 1] < indices[i]));
+    }
+    std::vector<size_t> kept;
+    kept.reserve(rank - indices.size());
+    auto it = indices.begin();
+    for (size_t i = 0; i < rank; ++i) {
+      if (it != indices.end() && *it == i) ++it;
+      else kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  // Erases every index for which pred(index) returns true.
+  template <typename Predicate>
+  void erase_rows_if(Predicate pred) {
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < rank; ++i) {
+      if (!pred(i)) kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  // Reorders the indices so that new index i is old index perm[i], which
+  // turns the array into P * A * P^T. The result is built in a second
+  // triangle by construct_permuted(), since moving cells along the cycles
+  // of the permutation would visit them in no useful order. Small inline
+  // arrays are permuted through a scratch buffer and assigned back, which
+  // only gives the basic guarantee if assignment throws.
+  void permute(const std::vector<size_t> & perm) {
+    check_permutation(perm);
+    if (rank == 0) return;
+    auto move = [](ValueType * target, ValueType * source) {
+      new (target) ValueType(std::move_if_noexcept(*source));
+    };
+    if (is_inline()) {
+      InlineBuffer<ValueType, inline_capacity> scratch;
+      construct_permuted(scratch.get(), perm, move);
+      try {
+        assign_run(data, scratch.get(), size, IsTrivial());
+      } catch (...) {
+        destroy(scratch.get(), scratch.get() + size);
+        throw;
+      }
+      destroy(scratch.get(), scratch.get() + size);
     } else {
-      check_arguments(row <= rank && col <= rank);
-      size_t new_rank = rank - 1;
-      size_t new_size = size - rank;
-      for (size_t r = row; r < new_rank; ++r) {
-        for (size_t c = 0; c <= r; ++c) {
-          data[to_linear_index(r, c)] =
-            data[to_linear_index(r + 1, c < row ? c : c + 1)];
-        }
+      size_t new_capacity = capacity;
+      ValueType * new_data = allocate(new_capacity);
+      try {
+        construct_permuted(new_data, perm, move);
+      } catch (...) {
+        deallocate(new_data, new_capacity);
+        throw;
       }
-      size_t start = to_linear_index(rank - 1, 0);
-      size_t end = to_linear_index(rank - 1, rank - 1) + 1;
-      for (size_t i = start; i < end; ++i) data[i].~ValueType();
-      rank = new_rank;
-      size = new_size;
+      destroy(data, data + size);
+      deallocate(data, capacity);
+      data = new_data;
+      capacity = new_capacity;
     }
+    record(Counter::elements_moved, size);
+  }
+
+  // Makes room for a triangle of the given rank so that growing up to it
+  // does not reallocate.
+  void reserve(size_t new_rank) {
+    size_t new_capacity = calculate_size(new_rank);
+    if (capacity < new_capacity) reallocate(new_capacity);
+  }
+
+  void shrink_to_fit() {
+    if (size < capacity && !is_inline()) reallocate(size);
   }
 
   size_t get_rank() const { return rank; }
 
+  size_t get_capacity() const { return calculate_rank(capacity); }
+
+  using Counters::record;
+  using Counters::get_statistics;
+
   Allocator get_allocator() const { return allocator; }
 
-  Implementation & operator=(Implementation o) {
-    swap(*this, o);
+  // The allocator follows propagate_on_container_copy_assignment
+  Implementation & operator=(const Implementation & o) {
+    if (this == &o) return *this;
+    Implementation copy(o);
+    replace(copy,
+      AllocatorTraits::propagate_on_container_copy_assignment::value);
+    return *this;
+  }
+
+  // The allocator follows propagate_on_container_move_assignment. If it
+  // stays and compares unequal, the elements are moved one by one.
+  Implementation & operator=(Implementation && o) {
+    if (this == &o) return *this;
+    replace(o,
+      AllocatorTraits::propagate_on_container_move_assignment::value);
     return *this;
   }
 
@@ -228,26 +759,48 @@ public:
     return data[to_linear_index(row, col)];
   }
 
+  // Exchanges heap buffers in constant time. Inline elements, and the
+  // elements of arrays whose allocators neither propagate on swap nor
+  // compare equal, have to be relocated, which only gives the basic
+  // guarantee if their move constructor throws.
   static void swap(Implementation & lhs, Implementation & rhs) {
+    bool propagate = AllocatorTraits::propagate_on_container_swap::value;
+    if (lhs.is_inline() || rhs.is_inline()
+        || !(propagate || lhs.allocator == rhs.allocator)) {
+      Implementation tmp(lhs.allocator);
+      tmp.take(lhs, true);
+      lhs.take(rhs, propagate);
+      rhs.take(tmp, propagate);
+      return;
+    }
     std::swap(lhs.rank, rhs.rank);
     std::swap(lhs.size, rhs.size);
     std::swap(lhs.capacity, rhs.capacity);
     std::swap(lhs.data, rhs.data);
-    std::swap(lhs.allocator, rhs.allocator);
+    Counters::swap(lhs, rhs);
+    swap_allocators(lhs, rhs,
+      typename AllocatorTraits::propagate_on_container_swap());
   }
 
 private:
+  // Walks the full rank x rank square row by row. The packed offset of the
+  // current cell is maintained incrementally, so stepping never goes
+  // through to_linear_index.
   template <bool IsConst>
   class ImplementationIterator {
   public:
     using difference_type = ptrdiff_t;
-    using value_type =
+    using value_type = ValueType;
+    using pointer =
+      std::conditional_t<
+        IsConst,
+        const ValueType *,
+        ValueType *>;
+    using reference =
       std::conditional_t<
         IsConst,
-        const ValueType,
-        ValueType>;
-    using pointer = ValueType *;
-    using reference = ValueType &;
+        const ValueType &,
+        ValueType &>;
     using iterator_category = std::random_access_iterator_tag;
 
   private:
@@ -260,6 +813,7 @@ private:
     ArrayPtr array;
     size_t row;
     size_t col;
+    size_t offset;
 
     size_t to_linear() const { return row * array->rank + col; }
 
@@ -267,22 +821,29 @@ private:
     ImplementationIterator()
         : array(nullptr)
         , row(0)
-        , col(0) { }
+        , col(0)
+        , offset(0) { }
 
     ImplementationIterator(ArrayPtr array, size_t row, size_t col)
         : array(array)
         , row(row)
-        , col(col) { }
+        , col(col)
+        , offset(to_linear_index(row, col)) { }
 
     operator ImplementationIterator<true>() const {
       return { array, row, col };
     }
 
     ImplementationIterator & operator++() {
-      ++col;
-      if (array->rank <= col) {
+      if (array->rank <= col + 1) {
         col = 0;
         ++row;
+        offset = sum_n(row);
+      } else {
+        // Left of the diagonal the row is contiguous, right of it every
+        // step skips to the next packed row.
+        offset += row <= col ? col + 1 : 1;
+        ++col;
       }
       return *this;
     }
@@ -294,10 +855,13 @@ private:
     }
 
     ImplementationIterator & operator--() {
-      --col;
-      if (array->rank <= col) {
-        col = array->rank - 1;
+      if (col == 0) {
         --row;
+        col = array->rank - 1;
+        offset = to_linear_index(row, col);
+      } else {
+        offset -= row < col ? col : 1;
+        --col;
       }
       return *this;
     }
@@ -308,12 +872,12 @@ private:
       return it;
     }
 
-    ValueType & operator*() const {
-      return (*array)(row, col);
+    reference operator*() const {
+      return array->data[offset];
     }
 
-    ValueType * operator->() const {
-      return std::addressof((*array)(row, col));
+    pointer operator->() const {
+      return array->data + offset;
     }
 
     ImplementationIterator & operator+=(difference_type x) {
@@ -321,22 +885,19 @@ private:
       difference_type t = to_linear() + x;
       row = t / rank;
       col = t % rank;
+      offset = to_linear_index(row, col);
       return *this;
     }
 
     ImplementationIterator & operator-=(difference_type x) {
-      auto rank = array->rank;
-      difference_type t = to_linear() - x;
-      row = t / rank;
-      col = t % rank;
-      return *this;
+      return *this += -x;
     }
 
     difference_type operator-(const ImplementationIterator & x) const {
       return to_linear() - x.to_linear();
     }
 
-    ValueType & operator[](difference_type x) const {
+    reference operator[](difference_type x) const {
       return *(*this + x);
     }
 
@@ -344,8 +905,12 @@ private:
         ImplementationIterator lhs,
         difference_type rhs) { return lhs += rhs; }
 
+    friend ImplementationIterator operator+(
+        difference_type lhs,
+        ImplementationIterator rhs) { return rhs += lhs; }
+
     friend ImplementationIterator operator-(
-        const ImplementationIterator & lhs,
+        ImplementationIterator lhs,
         difference_type rhs) { return lhs -= rhs; }
 
     friend bool operator==(const ImplementationIterator & lhs,
@@ -392,9 +957,95 @@ public:
   ConstIterator cbegin() const { return { this, 0, 0 }; }
   ConstIterator cend()   const { return { this, rank, 0 }; }
 
+private:
+  // One logical row of the square. Columns up to the diagonal are stored
+  // contiguously; the ones after it live in the following packed rows, so
+  // their stride grows by one with every column.
+  template <bool IsConst>
+  class ImplementationRow {
+  public:
+    using Iterator = ImplementationIterator<IsConst>;
+    using pointer = typename Iterator::pointer;
+    using reference = typename Iterator::reference;
+
+  private:
+    using ArrayPtr =
+      std::conditional_t<
+        IsConst,
+        const Implementation *,
+        Implementation *>;
+
+    ArrayPtr array;
+    size_t row;
+
+  public:
+    ImplementationRow(ArrayPtr array, size_t row)
+        : array(array)
+        , row(row) { }
+
+    operator ImplementationRow<true>() const { return { array, row }; }
+
+    size_t size() const { return array->rank; }
+
+    size_t get_row() const { return row; }
+
+    reference operator[](size_t col) const {
+      return array->data[to_linear_index(row, col)];
+    }
+
+    Iterator begin() const { return { array, row, 0 }; }
+    Iterator end()   const { return { array, row + 1, 0 }; }
+
+    // Columns [0, row]
+    pointer contiguous_begin() const { return array->data + sum_n(row); }
+    pointer contiguous_end()   const { return contiguous_begin() + row + 1; }
+
+    // Columns (row, rank), empty for the last row
+    Iterator strided_begin() const {
+      if (row + 1 == array->rank) return end();
+      return { array, row, row + 1 };
+    }
+
+    Iterator strided_end() const { return end(); }
+
+    // Calls f(col, value) for every column in order, walking both segments
+    // with plain pointer arithmetic.
+    template <typename F>
+    F for_each(F f) const {
+      pointer data = array->data;
+      size_t offset = sum_n(row);
+      for (size_t col = 0; col <= row; ++col) f(col, data[offset++]);
+      offset += row;
+      for (size_t col = row + 1; col < array->rank; offset += ++col) {
+        f(col, data[offset]);
+      }
+      return f;
+    }
+  };
+
+public:
+  using Row      = ImplementationRow<false>;
+  using ConstRow = ImplementationRow<true>;
+
+  Row row(size_t r) {
+    check_arguments(r < rank);
+    return { this, r };
+  }
+
+  ConstRow row(size_t r) const {
+    check_arguments(r < rank);
+    return { this, r };
+  }
+
+  // The packed lower triangle, row by row: (0, 0), (1, 0), (1, 1), ...
+  ValueType * triangle_begin() { return data; }
+  ValueType * triangle_end()   { return data + size; }
+
+  const ValueType * triangle_begin() const { return data; }
+  const ValueType * triangle_end()   const { return data + size; }
+
 };
 
 }
 
 }
-
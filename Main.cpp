@@ -1,13 +1,39 @@
+#include "Allocators.hpp"
+#include "ConcurrentUpdater.hpp"
+#include "FixedSymmetricSquareArray.hpp"
+#include "HugePageAllocator.hpp"
+#include "MappedStorage.hpp"
+#include "MinIndexedSymmetricSquareArray.hpp"
+#include "Parallel.hpp"
+#include "Reordering.hpp"
+#include "Serialization.hpp"
 #include "SymmetricSquareArray.hpp"
+#include "TiledSymmetricSquareArray.hpp"
+#include "VersionedSymmetricSquareArray.hpp"
 
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 
 #include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 
+// Strings are kept inline too, so that relocating inline elements with a
+// non-trivial move is covered.
+template <>
+struct metaprogramming::ssa::InlineRank<std::string>
+  : std::integral_constant<size_t, 2> { };
+
 using namespace metaprogramming;
 using namespace std;
 
@@ -27,6 +53,78 @@ operator<<(
   return os;
 }
 
+size_t allocation_count = 0;
+
+template <typename T>
+struct CountingAllocator : allocator<T> {
+  template <typename U>
+  struct rebind { using other = CountingAllocator<U>; };
+
+  CountingAllocator() = default;
+
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U> &) { }
+
+  T * allocate(size_t n) {
+    ++allocation_count;
+    return allocator<T>::allocate(n);
+  }
+};
+
+void test_inline_storage() {
+  {
+    using Array = SymmetricSquareArray<int, CountingAllocator<int>>;
+    allocation_count = 0;
+    Array a(4);
+    assert(1 == allocation_count);
+    a(3, 1) = 7;
+    a.insert(0, 0, 1);
+    assert(2 == allocation_count && 5 == a.get_rank());
+    a.erase(0, 0);
+    a.shrink_to_fit();
+    assert(7 == a(1, 3) && 4 == a.get_capacity());
+    Array b(a);
+    assert(3 == allocation_count);
+    b.erase(1, 0);
+    b.erase(0, 0);
+    b.shrink_to_fit();
+    Array c = b;
+    assert(2 == b.get_reference_count());
+    c(0, 0) = 2;
+    assert(4 == allocation_count && 0 == b(0, 0) && 2 == c(0, 0));
+  }
+  {
+    using Array = SymmetricSquareArray<string>;
+    Array a(2);
+    a(1, 0) = string(100, 'a');
+    a.insert(2, 2, "x");
+    assert(3 == a.get_rank() && string(100, 'a') == a(0, 1));
+    a.erase(2, 2);
+    a.shrink_to_fit();
+    assert(2 == a.get_capacity() && string(100, 'a') == a(0, 1));
+    Array b(1);
+    b(0, 0) = "y";
+    Array c(a);
+    c(0, 0) = "z";
+    swap(c, b);
+    assert("y" == c(0, 0) && "z" == b(0, 0) && "" == a(0, 0));
+  }
+  {
+    using Implementation = ssa::Implementation<string, allocator<string>>;
+    Implementation a(2);
+    a(1, 1) = string(50, 'b');
+    Implementation b(move(a));
+    assert(0 == a.get_rank() && string(50, 'b') == b(1, 1));
+    Implementation c(3);
+    c(2, 0) = "c";
+    Implementation::swap(b, c);
+    assert(3 == b.get_rank() && "c" == b(0, 2));
+    assert(2 == c.get_rank() && string(50, 'b') == c(1, 1));
+    a = c;
+    assert(string(50, 'b') == a(1, 1));
+  }
+}
+
 void test_cow() {
   {
     SymmetricSquareArray<int> a(1);
@@ -149,6 +247,1108 @@ void test_insert_and_erase() {
   }
 }
 
+void test_capacity() {
+  const size_t inline_rank = ssa::InlineRank<int>::value;
+  {
+    SymmetricSquareArray<int> a;
+    assert(inline_rank == a.get_capacity());
+    a.reserve(3);
+    assert(max<size_t>(3, inline_rank) == a.get_capacity());
+    assert(0 == a.get_rank());
+    a.insert(0, 0, 1);
+    a.insert(0, 0, 2);
+    a.insert(1, 1, 3);
+    assert(max<size_t>(3, inline_rank) == a.get_capacity());
+    assert(are_same({ 2, 0, 0,
+                      0, 3, 0,
+                      0, 0, 1 },
+                    a));
+    a.insert(1, 0, 4);
+    assert(are_same({ 0,  0, 4, 0, 0,
+                      0,  2, 0, 0, 0,
+                      4,  0, 0, 0, 0,
+                      0,  0, 0, 3, 0,
+                      0,  0, 0, 0, 1 },
+                    a));
+    a.erase(0, 2);
+    assert(are_same({ 2, 0, 0,
+                      0, 3, 0,
+                      0, 0, 1 },
+                    a));
+    assert(5 <= a.get_capacity());
+    a.shrink_to_fit();
+    assert(max<size_t>(3, inline_rank) == a.get_capacity());
+    assert(are_same({ 2, 0, 0,
+                      0, 3, 0,
+                      0, 0, 1 },
+                    a));
+  }
+  {
+    SymmetricSquareArray<int> a;
+    for (int i = 0; i < 100; ++i) {
+      a.insert(i / 2, i / 2, i);
+      assert(size_t(i + 1) <= a.get_capacity());
+    }
+    assert(100 == a.get_rank());
+    assert(99 == a(49, 49));
+    assert(98 == a(50, 50));
+    assert(0 == a(49, 50));
+  }
+}
+
+SymmetricSquareArray<int> make_numbered(size_t rank) {
+  SymmetricSquareArray<int> a(rank);
+  int n = 1;
+  for (size_t row = 0; row < rank; ++row) {
+    for (size_t col = 0; col <= row; ++col) a(row, col) = n++;
+  }
+  return a;
+}
+
+bool are_equal(
+    const SymmetricSquareArray<int> & lhs,
+    const SymmetricSquareArray<int> & rhs) {
+  if (lhs.get_rank() != rhs.get_rank()) return false;
+  for (size_t row = 0; row < lhs.get_rank(); ++row) {
+    for (size_t col = 0; col <= row; ++col) {
+      if (lhs(row, col) != rhs(row, col)) return false;
+    }
+  }
+  return true;
+}
+
+void test_insert_rows() {
+  {
+    SymmetricSquareArray<int> a = make_numbered(2);
+    a.insert_rows({ 0, 2, 3 }, 7);
+    assert(are_same({ 7, 0, 0, 0, 0,
+                      0, 1, 0, 0, 2,
+                      0, 0, 7, 0, 0,
+                      0, 0, 0, 7, 0,
+                      0, 2, 0, 0, 3 },
+                    a));
+  }
+  for (size_t reserved : { 0, 12 }) {
+    for (const auto & positions : vector<vector<size_t>>{
+        { }, { 0 }, { 5 }, { 0, 1, 2 }, { 1, 3, 6, 7 }, { 5, 6, 7 } }) {
+      SymmetricSquareArray<int> expected = make_numbered(5);
+      for (size_t p : positions) expected.insert(p, p, -1, -2);
+      SymmetricSquareArray<int> a = make_numbered(5);
+      a.reserve(reserved);
+      a.insert_rows(positions, -1, -2);
+      assert(are_equal(expected, a));
+    }
+  }
+}
+
+void test_erase_rows() {
+  {
+    SymmetricSquareArray<int> a = make_numbered(4);
+    a.erase_rows({ 0, 2 });
+    assert(are_same({ 3, 8,
+                      8, 10 },
+                    a));
+  }
+  for (const auto & indices : vector<vector<size_t>>{
+      { }, { 0 }, { 6 }, { 0, 1, 2 }, { 1, 3, 5, 6 }, { 0, 1, 2, 3, 4, 5, 6 } }) {
+    SymmetricSquareArray<int> expected = make_numbered(7);
+    for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+      expected.erase(*it, *it);
+    }
+    SymmetricSquareArray<int> a = make_numbered(7);
+    a.erase_rows(indices);
+    assert(are_equal(expected, a));
+    SymmetricSquareArray<int> b = make_numbered(7);
+    b.erase_rows_if([&](size_t i) {
+      return find(indices.begin(), indices.end(), i) != indices.end();
+    });
+    assert(are_equal(expected, b));
+  }
+}
+
+void test_insert_pair() {
+  for (size_t reserved : { 0, 10 }) {
+    for (size_t row = 0; row <= 5; ++row) {
+      for (size_t col = 0; col < row; ++col) {
+        SymmetricSquareArray<int> expected = make_numbered(5);
+        expected.insert(row, row, -2, -2);
+        expected.insert(col, col, -2, -2);
+        expected(row + 1, col) = -1;
+        SymmetricSquareArray<int> a = make_numbered(5);
+        a.reserve(reserved);
+        a.insert(row, col, -1, -2);
+        assert(are_equal(expected, a));
+        SymmetricSquareArray<int> b = make_numbered(5);
+        b.reserve(reserved);
+        b.insert(col, row, -1, -2);
+        assert(are_equal(expected, b));
+      }
+    }
+  }
+}
+
+void test_iterators() {
+  const SymmetricSquareArray<int> a = make_numbered(4);
+  vector<int> square(a.begin(), a.end());
+  assert(are_same(square, a));
+  vector<int> reversed(square.rbegin(), square.rend());
+  assert(equal(reversed.begin(), reversed.end(),
+               reverse_iterator<decltype(a.end())>(a.end())));
+  auto it = a.begin();
+  for (size_t i = 0; i < square.size(); ++i) {
+    assert(square[i] == *(a.begin() + i));
+    assert(square[i] == a.begin()[i]);
+    assert(square[i] == *(a.end() - (square.size() - i)));
+    assert(square[i] == *it++);
+  }
+  assert(a.end() == it);
+  vector<int> triangle(a.triangle_begin(), a.triangle_end());
+  assert((triangle == vector<int>{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }));
+  SymmetricSquareArray<int> b(a);
+  fill(b.triangle_begin(), b.triangle_end(), 0);
+  assert(0 == accumulate(b.begin(), b.end(), 0));
+  assert(90 == accumulate(a.cbegin(), a.cend(), 0));
+}
+
+void test_rows() {
+  const SymmetricSquareArray<int> a = make_numbered(5);
+  for (size_t r = 0; r < a.get_rank(); ++r) {
+    auto row = a.row(r);
+    assert(a.get_rank() == row.size());
+    vector<int> expected;
+    for (size_t col = 0; col < a.get_rank(); ++col) {
+      expected.push_back(a(r, col));
+      assert(a(r, col) == row[col]);
+    }
+    assert(equal(expected.begin(), expected.end(), row.begin(), row.end()));
+    vector<int> parts(row.contiguous_begin(), row.contiguous_end());
+    parts.insert(parts.end(), row.strided_begin(), row.strided_end());
+    assert(expected == parts);
+    size_t col = r + 1;
+    for (auto it = row.strided_begin(); it != row.strided_end(); ++it, ++col) {
+      assert(col < a.get_rank() && a(r, col) == *it);
+    }
+    assert(a.get_rank() == col);
+    vector<int> visited;
+    row.for_each([&](size_t col, int value) {
+      assert(visited.size() == col);
+      visited.push_back(value);
+    });
+    assert(expected == visited);
+    auto min = min_element(row.begin(), row.end());
+    assert(*min == *min_element(expected.begin(), expected.end()));
+  }
+  SymmetricSquareArray<int> b(a);
+  auto row = b.row(2);
+  fill(row.begin(), row.end(), 0);
+  assert(0 == b(2, 0) && 0 == b(4, 2) && 0 == b(2, 2));
+  assert(1 == a.get_reference_count());
+  assert(6 == a(2, 2));
+}
+
+template <typename T>
+void test_symv() {
+  for (size_t rank = 0; rank < 40; ++rank) {
+    SymmetricSquareArray<T> a(rank);
+    vector<T> x(rank);
+    vector<T> y(rank);
+    for (size_t row = 0; row < rank; ++row) {
+      x[row] = T(row % 7) - 3;
+      y[row] = T(row % 5);
+      for (size_t col = 0; col <= row; ++col) {
+        a(row, col) = T((row * 31 + col * 17) % 11) - 5;
+      }
+    }
+    vector<T> expected(rank);
+    for (size_t row = 0; row < rank; ++row) {
+      T sum = 0;
+      for (size_t col = 0; col < rank; ++col) sum += a(row, col) * x[col];
+      expected[row] = T(2) * sum + T(0.5) * y[row];
+    }
+    vector<T> scalar(y);
+    ssa::scale(rank, scalar.data(), T(0.5));
+    ssa::symv_scalar(size_t(0), rank, a.triangle_begin(), x.data(),
+      scalar.data(), T(2));
+    a.symv(x.data(), y.data(), T(2), T(0.5));
+    for (size_t row = 0; row < rank; ++row) {
+      assert(abs(expected[row] - y[row]) < 1e-3);
+      assert(abs(expected[row] - scalar[row]) < 1e-3);
+    }
+  }
+}
+
+void test_parallel() {
+  for (size_t rank : { 0, 1, 10, 600 }) {
+    for (size_t threads : { 1, 4 }) {
+      ThreadPool pool(threads);
+      SymmetricSquareArray<double> a(rank);
+      parallel_for_each(a, [](size_t row, size_t col, double & value) {
+        value = double((row * 7 + col * 3) % 13);
+      }, pool);
+      for (size_t row = 0; row < rank; ++row) {
+        for (size_t col = 0; col <= row; ++col) {
+          assert(double((row * 7 + col * 3) % 13) == a(row, col));
+        }
+      }
+      double sum = accumulate(a.triangle_begin(), a.triangle_end(), 0.0);
+      assert(sum == parallel_reduce(a, 0.0, plus<double>(), pool));
+      parallel_transform(a, [](double value) { return value * 2; }, pool);
+      assert(2 * sum == parallel_reduce(a, 0.0, plus<double>(), pool));
+      vector<double> x(rank);
+      for (size_t i = 0; i < rank; ++i) x[i] = double(i % 5);
+      vector<double> expected(rank, 1.0);
+      vector<double> y(rank, 1.0);
+      a.symv(x.data(), expected.data(), 0.5, 3.0);
+      parallel_symv(a, x.data(), y.data(), 0.5, 3.0, pool);
+      for (size_t i = 0; i < rank; ++i) assert(abs(expected[i] - y[i]) < 1e-6);
+    }
+  }
+  {
+    vector<size_t> bounds = ssa::partition_rows(1000, 4);
+    assert(5 == bounds.size() && 0 == bounds.front() && 1000 == bounds.back());
+    for (size_t k = 0; k + 1 < bounds.size(); ++k) {
+      size_t first = bounds[k] * (bounds[k] + 1) / 2;
+      size_t last = bounds[k + 1] * (bounds[k + 1] + 1) / 2;
+      assert(abs(double(last - first) - 500500 / 4.0) < 1000);
+    }
+  }
+  {
+    ThreadPool pool(3);
+    atomic<int> count(0);
+    bool thrown = false;
+    try {
+      pool.run(100, [&](size_t i) {
+        ++count;
+        if (i == 42) throw runtime_error("42");
+      });
+    } catch (const runtime_error &) {
+      thrown = true;
+    }
+    assert(thrown && 100 == count);
+  }
+}
+
+void test_generate() {
+  for (size_t rank : { 0, 1, 7, 600 }) {
+    ThreadPool pool(4);
+    auto a = SymmetricSquareArray<double>::generate(rank,
+      [](size_t row, size_t col) { return double(row) - double(col); },
+      pool);
+    assert(rank == a.get_rank());
+    assert(a.get_is_sharable());
+    for (size_t row = 0; row < rank; ++row) {
+      for (size_t col = 0; col < rank; ++col) {
+        assert(abs(double(row) - double(col)) == a(row, col));
+      }
+    }
+  }
+  {
+    ThreadPool pool(4);
+    bool thrown = false;
+    try {
+      SymmetricSquareArray<string>::generate(600,
+        [](size_t row, size_t col) {
+          if (row == 500 && col == 3) throw runtime_error("generate");
+          return string(40, char('a' + col % 26));
+        },
+        pool);
+    } catch (const runtime_error &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+  auto serial = SymmetricSquareArray<int>::from_function(5,
+    [](size_t row, size_t col) { return int(row * 10 + col); });
+  assert(serial.get_is_sharable() && 5 == serial.get_rank());
+  assert(43 == serial(3, 4) && 40 == serial(4, 0));
+}
+
+using Bits = SymmetricSquareArray<bool, allocator<bool>, ssa::BitLayout>;
+
+bool are_equal(
+    const SymmetricSquareArray<int> & lhs,
+    const Bits & rhs) {
+  if (lhs.get_rank() != rhs.get_rank()) return false;
+  for (size_t row = 0; row < lhs.get_rank(); ++row) {
+    for (size_t col = 0; col <= row; ++col) {
+      if ((lhs(row, col) != 0) != rhs(row, col)) return false;
+    }
+  }
+  return true;
+}
+
+void test_bits() {
+  const size_t rank = 150;
+  Bits a(rank);
+  SymmetricSquareArray<int> expected(rank);
+  for (size_t row = 0; row < rank; ++row) {
+    for (size_t col = 0; col <= row; ++col) {
+      bool bit = (row * 7 + col * 13) % 5 < 2;
+      a(row, col) = bit;
+      expected(row, col) = bit;
+    }
+  }
+  assert(are_equal(expected, a));
+  vector<uint64_t> bits(a.get_row_word_count());
+  for (size_t i = 0; i < rank; ++i) {
+    a.get_row(i, bits.data());
+    size_t degree = 0;
+    for (size_t k = 0; k < rank; ++k) {
+      assert(expected(i, k) == int((bits[k / 64] >> (k % 64)) & 1));
+      degree += expected(i, k);
+    }
+    assert(degree == a.degree(i));
+  }
+  for (size_t i = 0; i < rank; i += 7) {
+    for (size_t j = 0; j < rank; j += 5) {
+      size_t common = 0;
+      for (size_t k = 0; k < rank; ++k) {
+        common += expected(i, k) && expected(j, k);
+      }
+      assert(common == a.common_neighbors(i, j));
+    }
+  }
+  size_t triangles = 0;
+  for (size_t i = 0; i < rank; ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      for (size_t k = 0; k < j; ++k) {
+        triangles += expected(i, j) && expected(j, k) && expected(i, k);
+      }
+    }
+  }
+  assert(triangles == a.count_triangles());
+  Bits b(a);
+  assert(2 == a.get_reference_count());
+  b(3, 100).flip();
+  assert(1 == a.get_reference_count());
+  assert(a(100, 3) != b(100, 3));
+  a.insert(70, 2, true);
+  expected.insert(70, 2, 1);
+  a.insert_rows({ 0, 40, 152 }, true);
+  expected.insert_rows({ 0, 40, 152 }, 1);
+  assert(are_equal(expected, a));
+  a.erase_rows({ 1, 2, 90 });
+  expected.erase_rows({ 1, 2, 90 });
+  a.erase(5, 9);
+  expected.erase(5, 9);
+  a.erase_rows_if([](size_t i) { return i % 11 == 3; });
+  expected.erase_rows_if([](size_t i) { return i % 11 == 3; });
+  assert(are_equal(expected, a));
+
+  SymmetricSquareArray<bool> dense(5);
+  dense.reserve(8);
+  dense(3, 1) = true;
+  *dense.row(4).begin() = true;
+  assert(8 == dense.get_capacity() && 4 == bandwidth(dense, false));
+  assert(4 == count(dense.begin(), dense.end(), true));
+  assert(5 == reverse_cuthill_mckee(dense, false).size());
+}
+
+void test_sparse() {
+  using Sparse = SymmetricSquareArray<int, allocator<int>, ssa::SparseLayout>;
+  SymmetricSquareArray<int> expected(40);
+  for (size_t row = 0; row < 40; ++row) {
+    for (size_t col = 0; col <= row; ++col) {
+      expected(row, col) = (row * 5 + col * 3) % 7 == 0 ? int(row + col) : 0;
+    }
+  }
+  Sparse a(expected);
+  assert(40 == a.get_rank());
+  assert(are_equal(expected, a.to_dense()));
+  size_t count = 0;
+  for (auto it = a.begin(); it != a.end(); ++it, ++count) {
+    assert(0 != *it && expected(it.row(), it.col()) == *it);
+  }
+  assert(count == a.get_entry_count());
+  Sparse b(a);
+  assert(2 == a.get_reference_count());
+  b(3, 38) = 17;
+  assert(1 == a.get_reference_count());
+  assert(17 == b(38, 3) && expected(38, 3) == a(38, 3));
+  b(3, 38) = 0;
+  assert(count == b.get_entry_count());
+  a.insert(20, 3, 5);
+  expected.insert(20, 3, 5);
+  a.insert(7, 7, 9, 1);
+  expected.insert(7, 7, 9, 1);
+  a.insert_rows({ 0, 12, 43 }, 2);
+  expected.insert_rows({ 0, 12, 43 }, 2);
+  assert(are_equal(expected, a.to_dense()));
+  a.erase_rows({ 1, 8, 30 });
+  expected.erase_rows({ 1, 8, 30 });
+  a.erase(4, 9);
+  expected.erase(4, 9);
+  a.erase_rows_if([](size_t i) { return i % 6 == 5; });
+  expected.erase_rows_if([](size_t i) { return i % 6 == 5; });
+  assert(are_equal(expected, a.to_dense()));
+  const SymmetricSquareArray<int> dense = a.to_dense();
+  SymmetricSquareArray<int> shared(dense);
+  assert(dense.get_is_sharable() && 2 == dense.get_reference_count());
+  Sparse c(3, -1);
+  assert(-1 == c(2, 0) && 0 == c.get_entry_count());
+  c(2, 0) = 4;
+  c.insert(1, 1, 6);
+  assert(2 == c.get_entry_count() && 4 == c(3, 0) && 6 == c(1, 1));
+  assert(-1 == c(2, 0) && -1 == c(1, 0));
+}
+
+void test_fixed() {
+  using Stress = FixedSymmetricSquareArray<double, 3>;
+  static_assert(6 == Stress::size, "");
+  static_assert(4 == Stress::to_linear_index(1, 2), "");
+  constexpr Stress zero;
+  static_assert(0.0 == zero(2, 1), "");
+  FixedSymmetricSquareArray<int, 10> a(make_numbered(10));
+  assert(10 == a.get_rank() && 55 == a(9, 9) && 9 == a(2, 3));
+  assert(are_equal(make_numbered(10), a.to_array()));
+  const SymmetricSquareArray<int> plain = a.to_array();
+  SymmetricSquareArray<int> shared(plain);
+  assert(plain.get_is_sharable() && 2 == plain.get_reference_count());
+  FixedSymmetricSquareArray<int, 10> b(a);
+  b(4, 7) = -1;
+  assert(-1 == b(7, 4) && a != b);
+  b.transform([](int x) { return 2 * x; });
+  assert(-2 == b(7, 4) && 110 == b(9, 9));
+  SymmetricSquareArray<int> numbered = make_numbered(10);
+  vector<int> x(10), y(10, 1), z(10, 1);
+  iota(x.begin(), x.end(), -3);
+  a.symv(x.data(), y.data(), 2, 3);
+  numbered.symv(x.data(), z.data(), 2, 3);
+  assert(y == z);
+  bool thrown = false;
+  try {
+    FixedSymmetricSquareArray<int, 3> c(numbered);
+  } catch (const runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+  assert(3.5 == Stress(3.5)(0, 2));
+}
+
+// Arena allocator that stays with its array on assignment and swap, so
+// arrays on different arenas have to relocate their elements
+template <typename T>
+struct StayingArenaAllocator : ArenaAllocator<T> {
+  using propagate_on_container_copy_assignment = false_type;
+  using propagate_on_container_move_assignment = false_type;
+  using propagate_on_container_swap = false_type;
+
+  template <typename U>
+  struct rebind {
+    using other = StayingArenaAllocator<U>;
+  };
+
+  StayingArenaAllocator(MonotonicArena & arena) : ArenaAllocator<T>(arena) { }
+
+  template <typename U>
+  StayingArenaAllocator(const StayingArenaAllocator<U> & o)
+    : ArenaAllocator<T>(o) { }
+};
+
+void test_allocators() {
+  {
+    MonotonicArena arena(256);
+    using Array = SymmetricSquareArray<double, ArenaAllocator<double>>;
+    Array a(30, arena);
+    a(29, 0) = 1.5;
+    Array b(a);
+    b(3, 4) = 2;
+    assert(&b.get_allocator().get_arena() == &arena);
+    assert(1.5 == b(0, 29) && 0 == a(3, 4));
+    for (int i = 0; i < 20; ++i) a.insert(0, 0, i);
+    assert(1.5 == a(20, 49));
+    MonotonicArena other;
+    Array c(5, other);
+    c = b;
+    assert(&c.get_allocator().get_arena() == &arena && 2 == c(4, 3));
+  }
+  {
+    SizeClassPool pool;
+    using Array = SymmetricSquareArray<int, PoolAllocator<int>>;
+    const int * first;
+    {
+      Array a(100, pool);
+      first = a.triangle_begin();
+    }
+    Array b(100, pool);
+    assert(first == b.triangle_begin());
+    b(99, 98) = 3;
+    Array c(b);
+    c.erase(0, 0);
+    assert(3 == c(97, 98) && &c.get_allocator().get_pool() == &pool);
+  }
+  {
+    MonotonicArena first;
+    MonotonicArena second;
+    using Implementation =
+      ssa::Implementation<int, ArenaAllocator<int>>;
+    Implementation a(40, first);
+    Implementation b(50, second);
+    a(39, 39) = 1;
+    Implementation::swap(a, b);
+    assert(&a.get_allocator().get_arena() == &second);
+    assert(&b.get_allocator().get_arena() == &first && 1 == b(39, 39));
+  }
+  {
+    using Implementation =
+      ssa::Implementation<int, StayingArenaAllocator<int>>;
+    MonotonicArena first;
+    Implementation a(40, first);
+    {
+      MonotonicArena second;
+      Implementation b(50, second);
+      b(49, 0) = 2;
+      a = move(b);
+      assert(&a.get_allocator().get_arena() == &first);
+      assert(50 == a.get_rank() && 2 == a(49, 0) && 0 == b.get_rank());
+      Implementation c(30, second);
+      c(29, 29) = 3;
+      Implementation::swap(a, c);
+      assert(&a.get_allocator().get_arena() == &first && 3 == a(29, 29));
+      assert(&c.get_allocator().get_arena() == &second && 2 == c(49, 0));
+      a = c;
+      assert(&a.get_allocator().get_arena() == &first);
+    }
+    // The other arena is gone, so a must not refer to its memory
+    assert(50 == a.get_rank() && 2 == a(49, 0));
+  }
+}
+
+void test_huge_pages() {
+  using Array = SymmetricSquareArray<double, HugePageAllocator<double>>;
+  Array a = Array::filled(1500, 0.5);
+  assert(1500 == a.get_rank() && 0.5 == a(1499, 0));
+#ifdef SSA_LINUX_PAGES
+  uintptr_t data = reinterpret_cast<uintptr_t>(a.triangle_begin());
+  assert(0 == data % ssa::huge_page_size);
+#endif
+  Array b(a);
+  b(7, 1400) = 2;
+  assert(0.5 == a(7, 1400) && 2 == b(1400, 7));
+  Array c = Array::generate(1200,
+    [](size_t row, size_t col) { return double(row * col); },
+    default_thread_pool(),
+    HugePageAllocator<double>(NumaPolicy::interleave));
+  assert(NumaPolicy::interleave == c.get_allocator().get_policy());
+  assert(1199.0 * 3 == c(3, 1199));
+  Array small(3);
+  assert(0 == small(2, 1));
+}
+
+void test_mapped_storage() {
+  const string path = "test_mapped_storage.bin";
+  SymmetricSquareArray<int> numbered = make_numbered(40);
+  SymmetricSquareArray<int32_t> saved(40);
+  copy(numbered.triangle_begin(), numbered.triangle_end(),
+    saved.triangle_begin());
+  save_mapped(path, saved);
+  {
+    auto a = open_mapped<int32_t>(path);
+    const auto & view = a;
+    assert(a.get_allocator().is_mapped());
+    assert(40 == a.get_rank() && 820 == view(39, 39) && 9 == view(3, 2));
+    auto b = a;
+    assert(2 == a.get_reference_count());
+    b(0, 0) = -1;
+    assert(!b.get_allocator().is_mapped() && 1 == view(0, 0));
+    a(1, 0) = -2;
+    MappedAllocator<char> rebound(a.get_allocator());
+    assert(!rebound.is_mapped() && rebound == a.get_allocator());
+    a.insert(5, 5, 7);
+    assert(-2 == a(0, 1) && 7 == a(5, 5) && 41 == a.get_rank());
+    assert(!a.get_allocator().is_mapped());
+  }
+  {
+    auto a = open_mapped<int32_t>(path, MapMode::read_write);
+    assert(2 == a(1, 0));
+    a(1, 0) = -3;
+  }
+  assert(-3 == open_mapped<int32_t>(path)(0, 1));
+  bool thrown = false;
+  try {
+    open_mapped<double>(path);
+  } catch (const runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+  {
+    fstream file(path, ios::binary | ios::in | ios::out);
+    uint64_t rank = uint64_t(1) << 33;
+    file.seekp(offsetof(ssa::FileHeader, rank));
+    file.write(reinterpret_cast<const char *>(&rank), sizeof(rank));
+  }
+  thrown = false;
+  try {
+    open_mapped<int32_t>(path);
+  } catch (const runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+  remove(path.c_str());
+}
+
+void test_serialization() {
+  SymmetricSquareArray<int> numbered = make_numbered(300);
+  SymmetricSquareArray<int32_t> ints(300);
+  copy(numbered.triangle_begin(), numbered.triangle_end(),
+    ints.triangle_begin());
+  stringstream plain;
+  write(plain, ints, Compression::none, 4096);
+  auto a = read<int32_t>(plain);
+  assert(equal(a.triangle_begin(), a.triangle_end(), ints.triangle_begin()));
+  assert(300 == a.get_rank());
+
+  SymmetricSquareArray<double> smooth(200);
+  for (size_t i = 0; i < 200; ++i) {
+    for (size_t j = 0; j <= i; ++j) smooth(i, j) = double(i % 7 + j % 3);
+  }
+  stringstream packed;
+  write(packed, smooth, Compression::shuffle_lz, 1000);
+  string bytes = packed.str();
+  assert(bytes.size() < 201 * 100 * sizeof(double) / 4);
+  auto b = read<double>(packed);
+  assert(equal(b.triangle_begin(), b.triangle_end(), smooth.triangle_begin()));
+
+  stringstream empty;
+  write(empty, SymmetricSquareArray<double>(0), Compression::shuffle_lz);
+  assert(0 == read<double>(empty).get_rank());
+
+  auto fails = [](const string & contents, bool as_double) {
+    stringstream in(contents);
+    try {
+      if (as_double) read<double>(in);
+      else read<int32_t>(in);
+    } catch (const runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  string corrupt = bytes;
+  corrupt[corrupt.size() / 2] ^= 0x55;
+  assert(fails(corrupt, true));
+  assert(fails(bytes.substr(0, bytes.size() - 1), true));
+  assert(fails(bytes, false));
+  assert(fails(plain.str().substr(0, 100), false));
+  for (uint64_t rank : { ssa::stream_max_rank + 1, uint64_t(1) << 62 }) {
+    string huge = plain.str();
+    huge.replace(offsetof(ssa::StreamHeader, rank), sizeof(rank),
+      reinterpret_cast<const char *>(&rank), sizeof(rank));
+    assert(fails(huge, false));
+  }
+  // Within stream_max_rank, but the triangle would take terabytes: rejected
+  // from the size of the stream instead of failing in the allocator
+  auto reason = [](string contents, bool as_double) {
+    uint64_t rank = ssa::stream_max_rank;
+    contents.replace(offsetof(ssa::StreamHeader, rank), sizeof(rank),
+      reinterpret_cast<const char *>(&rank), sizeof(rank));
+    stringstream in(contents);
+    try {
+      if (as_double) read<double>(in);
+      else read<int32_t>(in);
+    } catch (const runtime_error & e) {
+      return string(e.what());
+    }
+    return string();
+  };
+  assert("stream: rank exceeds the stream" == reason(plain.str(), false));
+  assert("stream: rank exceeds the stream" == reason(bytes, true));
+  string retagged = bytes;
+  uint32_t none = uint32_t(Compression::none);
+  retagged.replace(offsetof(ssa::StreamHeader, compression), sizeof(none),
+    reinterpret_cast<const char *>(&none), sizeof(none));
+  assert(fails(retagged, true));
+}
+
+void test_statistics() {
+  reset_global_statistics();
+  {
+    SymmetricSquareArray<int> a(10);
+    a.reserve(20);
+    a.insert(0, 0, 1);
+    a.erase(0, 0);
+    SymmetricSquareArray<int> b(a);
+    b(1, 1) = 2;
+    const SymmetricSquareArray<int> c(b);
+    Statistics s = a.get_statistics();
+    assert(string("elements_moved")
+      == Statistics::name(Counter::elements_moved));
+    if (!statistics_enabled) {
+      assert(0 == s[Counter::allocations]);
+      assert(0 == c.get_statistics()[Counter::clones]);
+      assert(0 == get_global_statistics()[Counter::elements_constructed]);
+      return;
+    }
+    assert(2 == s[Counter::allocations]);
+    assert((55 + 210) * sizeof(int) == s[Counter::bytes_allocated]);
+    assert(66 == s[Counter::elements_constructed]);
+    assert(3 * 55 == s[Counter::elements_moved]);
+    assert(11 == s[Counter::elements_destroyed]);
+    assert(0 == s[Counter::clones] && 0 == s[Counter::sharing_changes]);
+    s = b.get_statistics();
+    assert(3 == s[Counter::allocations] && 55 == s[Counter::elements_copied]);
+    assert(1 == s[Counter::clones] && 1 == s[Counter::sharing_changes]);
+    s = c.get_statistics();
+    assert(4 == s[Counter::allocations] && 110 == s[Counter::elements_copied]);
+    assert(2 == s[Counter::clones] && 1 == s[Counter::sharing_changes]);
+    s = get_global_statistics();
+    assert(4 == s[Counter::allocations]);
+    assert(66 == s[Counter::elements_constructed]);
+    assert(110 == s[Counter::elements_copied] && 2 == s[Counter::clones]);
+    assert(11 == s[Counter::elements_destroyed]);
+  }
+  assert(11 + 3 * 55 == get_global_statistics()[Counter::elements_destroyed]);
+}
+
+void test_permute() {
+  const SymmetricSquareArray<int> a = make_numbered(6);
+  vector<size_t> perm = { 2, 0, 5, 1, 4, 3 };
+  SymmetricSquareArray<int> b(a);
+  b.permute(perm);
+  assert(1 == a.get_reference_count() && 1 == a(0, 0));
+  for (size_t i = 0; i < 6; ++i) {
+    for (size_t j = 0; j < 6; ++j) assert(a(perm[i], perm[j]) == b(i, j));
+  }
+  for (const vector<size_t> & wrong : vector<vector<size_t>>{
+      { 0, 1, 2 }, { 0, 1, 2, 3, 4, 4 }, { 0, 1, 2, 3, 4, 6 } }) {
+    bool thrown = false;
+    try {
+      b.permute(wrong);
+    } catch (const runtime_error &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+  SymmetricSquareArray<string> names(3);
+  names(0, 0) = "a";
+  names(1, 0) = "b";
+  names(2, 1) = "c";
+  names.permute({ 2, 1, 0 });
+  assert("a" == names(2, 2) && "b" == names(1, 2) && "c" == names(0, 1));
+  SymmetricSquareArray<string> pair(2);
+  pair(1, 0) = "x";
+  pair(1, 1) = "y";
+  pair.permute({ 1, 0 });
+  assert("y" == pair(0, 0) && "x" == pair(1, 0) && "" == pair(1, 1));
+  SymmetricSquareArray<int> small = make_numbered(3);
+  small.permute({ 1, 2, 0 });
+  assert(3 == small(0, 0) && 5 == small(0, 1) && 2 == small(0, 2));
+  assert(1 == small(2, 2));
+  SymmetricSquareArray<int> none;
+  none.permute({});
+
+  // A heap buffer below the inline capacity moves into the inline buffer
+  allocator<int> ints;
+  int * adopted_data = ints.allocate(3);
+  adopted_data[0] = 1;
+  adopted_data[1] = 2;
+  adopted_data[2] = 3;
+  auto adopted = SymmetricSquareArray<int>::adopt(2, 3, adopted_data);
+  adopted.permute({ 1, 0 });
+  adopted.insert(0, 0, 100);
+  assert(100 == adopted(0, 0) && 0 == adopted(1, 0) && 0 == adopted(2, 0));
+  assert(3 == adopted(1, 1) && 2 == adopted(2, 1) && 1 == adopted(2, 2));
+
+  const SymmetricSquareArray<int> large = make_numbered(100);
+  vector<size_t> mixed(100);
+  iota(mixed.begin(), mixed.end(), 0);
+  shuffle(mixed.begin(), mixed.end(), mt19937(3));
+  SymmetricSquareArray<int> gathered(large);
+  gathered.permute(mixed);
+  assert(1 == large.get_reference_count());
+  assert(large.get_statistics()[Counter::clones] + statistics_enabled
+    == gathered.get_statistics()[Counter::clones]);
+  for (size_t i = 0; i < 100; ++i) {
+    for (size_t j = 0; j < 100; ++j) {
+      assert(large(mixed[i], mixed[j]) == gathered(i, j));
+    }
+  }
+  gathered.permute(mixed);
+  for (size_t i = 0; i < 100; ++i) {
+    for (size_t j = 0; j < 100; ++j) {
+      assert(large(mixed[mixed[i]], mixed[mixed[j]]) == gathered(i, j));
+    }
+  }
+
+  const size_t rank = 40;
+  SymmetricSquareArray<int> band(rank);
+  for (size_t i = 0; i < rank; ++i) {
+    for (size_t j = i; j < min(rank, i + 3); ++j) band(i, j) = 1;
+  }
+  vector<size_t> shuffled(rank);
+  iota(shuffled.begin(), shuffled.end(), 0);
+  shuffle(shuffled.begin(), shuffled.end(), mt19937(7));
+  band.permute(shuffled);
+  assert(2 < bandwidth(band));
+  vector<size_t> order = reverse_cuthill_mckee(band);
+  band.permute(order);
+  assert(2 == bandwidth(band));
+  assert(rank + (rank - 1) + (rank - 2)
+    == size_t(accumulate(band.triangle_begin(), band.triangle_end(), 0)));
+}
+
+void test_min_index() {
+  MinIndexedSymmetricSquareArray<int> a(make_numbered(5));
+  assert(make_pair(size_t(1), size_t(0)) == a.argmin() && 2 == a.min());
+  a(3, 4) = -1;
+  assert(make_pair(size_t(4), size_t(3)) == a.argmin());
+  a(4, 3) = 100;
+  assert(make_pair(size_t(1), size_t(0)) == a.argmin());
+  bool thrown = false;
+  try {
+    MinIndexedSymmetricSquareArray<int>(SymmetricSquareArray<int>(1)).argmin();
+  } catch (const runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+
+  // Random edits against a full scan, with few distinct values for ties
+  mt19937 random(3);
+  MinIndexedSymmetricSquareArray<int> b(SymmetricSquareArray<int>(12));
+  auto check = [&] {
+    const SymmetricSquareArray<int> & view = b.get_array();
+    pair<size_t, size_t> best(0, 0);
+    for (size_t i = 1; i < view.get_rank(); ++i) {
+      for (size_t j = 0; j < i; ++j) {
+        if (best.first == 0 || view(i, j) < view(best.first, best.second)) {
+          best = { i, j };
+        }
+      }
+    }
+    assert(best == b.argmin());
+  };
+  for (int step = 0; step < 2000; ++step) {
+    size_t rank = b.get_rank();
+    switch (random() % 8) {
+      case 0:
+        if (rank < 20) b.insert(random() % (rank + 1), 0, int(random() % 9));
+        break;
+      case 1:
+        if (4 < rank) b.erase(random() % rank, random() % rank);
+        break;
+      case 2:
+        if (rank < 20) b.insert_rows({ 0, rank / 2 + 1, rank + 1 }, 5, 3);
+        break;
+      case 3:
+        if (6 < rank) b.erase_rows({ 1, rank / 2, rank - 1 });
+        break;
+      default:
+        b(random() % rank, random() % rank) = int(random() % 9);
+    }
+    check();
+  }
+}
+
+void test_tiles() {
+  SymmetricSquareArray<int> numbered = make_numbered(10);
+  TiledSymmetricSquareArray<int, 8> a(numbered);
+  assert(10 == a.get_rank());
+  assert(7 == a.get_tile_count());
+  assert(are_equal(numbered, a.to_array()));
+  const SymmetricSquareArray<int> plain = a.to_array();
+  SymmetricSquareArray<int> shared(plain);
+  assert(plain.get_is_sharable() && 2 == plain.get_reference_count());
+  TiledSymmetricSquareArray<int, 8> b(a);
+  assert(2 == a.get_reference_count(9, 9));
+  b.set(9, 9, -1);
+  assert(1 == a.get_reference_count(9, 9));
+  assert(1 == b.get_reference_count(9, 9));
+  assert(2 == a.get_reference_count(0, 0));
+  assert(55 == a(9, 9) && -1 == b(9, 9));
+  int & reference = b(0, 3);
+  assert(1 == a.get_reference_count(0, 0));
+  TiledSymmetricSquareArray<int, 8> c(b);
+  reference = -2;
+  assert(-2 == b(3, 0) && 7 == c(3, 0) && 7 == a(3, 0));
+  assert(1 == c.get_reference_count(0, 0));
+  assert(3 == c.get_reference_count(5, 5));
+  TiledSymmetricSquareArray<int, 8> d(3, 4);
+  assert(4 == d(2, 1));
+  d = c;
+  assert(4 == c.get_reference_count(5, 5));
+}
+
+void test_versions() {
+  VersionedSymmetricSquareArray<int> versions(SymmetricSquareArray<int>(20));
+  auto first = versions.snapshot();
+  atomic<bool> done(false);
+  auto read = [&] {
+    while (!done) {
+      auto snapshot = versions.snapshot();
+      int value = (*snapshot)(0, 0);
+      for (auto it = snapshot->cbegin(); it != snapshot->cend(); ++it) {
+        assert(value == *it);
+      }
+    }
+  };
+  thread reader1(read);
+  thread reader2(read);
+  for (int i = 1; i <= 200; ++i) {
+    versions.update([&](SymmetricSquareArray<int> & array) {
+      fill(array.triangle_begin(), array.triangle_end(), i);
+    });
+  }
+  done = true;
+  reader1.join();
+  reader2.join();
+  assert(200 == versions.get_version());
+  assert(200 == (*versions.snapshot())(19, 3));
+  assert(0 == (*first)(19, 3));
+  assert(1 == first.use_count());
+  bool thrown = false;
+  try {
+    versions.update([](SymmetricSquareArray<int> & array) {
+      array.insert(0, 0, 1);
+      throw runtime_error("update");
+    });
+  } catch (const runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown && 20 == versions.snapshot()->get_rank());
+  versions.publish(SymmetricSquareArray<int>(3));
+  assert(3 == versions.snapshot()->get_rank());
+}
+
+template <typename T>
+void test_concurrent_updates(T delta) {
+  SymmetricSquareArray<T> a(16);
+  SymmetricSquareArray<T> b(a);
+  ConcurrentUpdater<T> updater(a);
+  vector<thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < 5000; ++i) {
+        size_t row = (i * 7 + t) % 16;
+        size_t col = (i * 3) % 16;
+        updater.fetch_add(row, col, delta);
+        updater.update(col, row, [&](T & value) { value += delta; });
+      }
+    });
+  }
+  for (auto & thread : threads) thread.join();
+  T total = accumulate(a.triangle_begin(), a.triangle_end(), T());
+  assert(T(40000) * delta == total);
+  assert(T() == accumulate(b.triangle_begin(), b.triangle_end(), T()));
+  assert(updater.load(3, 5) == a(5, 3));
+}
+
+void test_concurrent_string_updates() {
+  SymmetricSquareArray<string> a(4);
+  ConcurrentUpdater<string> updater(a, 3);
+  vector<thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (size_t i = 0; i < 1000; ++i) {
+        updater.update(i % 4, (i / 4) % 4, [](string & s) { s += 'x'; });
+      }
+    });
+  }
+  for (auto & thread : threads) thread.join();
+  size_t length = 0;
+  for (auto it = a.triangle_begin(); it != a.triangle_end(); ++it) {
+    length += it->size();
+  }
+  assert(4000 == length);
+}
+
+struct Fragile {
+  static int copies_left; // Negative means unlimited
+  int value;
+
+  Fragile(int value = 0) : value(value) { }
+
+  Fragile(const Fragile & o) : value(o.value) {
+    if (copies_left == 0) throw runtime_error("Fragile");
+    if (copies_left > 0) --copies_left;
+  }
+
+  Fragile(Fragile && o) noexcept : value(o.value) { o.value = -1; }
+
+  Fragile & operator=(const Fragile & o) {
+    if (copies_left == 0) throw runtime_error("Fragile");
+    if (copies_left > 0) --copies_left;
+    value = o.value;
+    return *this;
+  }
+
+  Fragile & operator=(Fragile && o) noexcept {
+    value = o.value;
+    o.value = -1;
+    return *this;
+  }
+};
+
+int Fragile::copies_left = -1;
+
+SymmetricSquareArray<Fragile> to_fragile(const SymmetricSquareArray<int> & a) {
+  SymmetricSquareArray<Fragile> result(a.get_rank());
+  for (size_t row = 0; row < a.get_rank(); ++row) {
+    for (size_t col = 0; col <= row; ++col) result(row, col) = a(row, col);
+  }
+  return result;
+}
+
+bool are_equal(
+    const SymmetricSquareArray<int> & lhs,
+    const SymmetricSquareArray<Fragile> & rhs) {
+  if (lhs.get_rank() != rhs.get_rank()) return false;
+  for (size_t row = 0; row < lhs.get_rank(); ++row) {
+    for (size_t col = 0; col <= row; ++col) {
+      if (lhs(row, col) != rhs(row, col).value) return false;
+    }
+  }
+  return true;
+}
+
+void test_relocation() {
+  for (size_t reserved : { 0, 10 }) {
+    SymmetricSquareArray<int> expected = make_numbered(5);
+    SymmetricSquareArray<Fragile> a = to_fragile(expected);
+    a.reserve(reserved);
+    expected.insert(3, 1, -1, -2);
+    a.insert(3, 1, Fragile(-1), Fragile(-2));
+    assert(are_equal(expected, a));
+    expected.insert_rows({ 0, 4 }, -3);
+    a.insert_rows({ 0, 4 }, Fragile(-3));
+    assert(are_equal(expected, a));
+    expected.erase_rows({ 1, 2, 6 });
+    a.erase_rows({ 1, 2, 6 });
+    assert(are_equal(expected, a));
+  }
+  for (size_t reserved : { 0, 10 }) {
+    for (int copies = 0; copies < 12; ++copies) {
+      SymmetricSquareArray<int> expected = make_numbered(5);
+      SymmetricSquareArray<Fragile> a = to_fragile(expected);
+      a.reserve(reserved);
+      Fragile::copies_left = copies;
+      try {
+        a.insert(3, 1, Fragile(-1), Fragile(-2));
+        expected.insert(3, 1, -1, -2);
+      } catch (const runtime_error &) { }
+      Fragile::copies_left = -1;
+      assert(are_equal(expected, a));
+      assert(max<size_t>(reserved, 5) <= a.get_capacity());
+    }
+  }
+  const SymmetricSquareArray<int> numbered = make_numbered(40);
+  const SymmetricSquareArray<Fragile> source =
+    SymmetricSquareArray<Fragile>::generate(40,
+      [&](size_t row, size_t col) { return Fragile(numbered(row, col)); });
+  vector<size_t> reversed(40);
+  iota(reversed.rbegin(), reversed.rend(), 0);
+  SymmetricSquareArray<int> expected(numbered);
+  expected.permute(reversed);
+  for (int copies : { 0, 1, 500, 820 }) {
+    SymmetricSquareArray<Fragile> a(source);
+    Fragile::copies_left = copies;
+    try {
+      a.permute(reversed);
+    } catch (const runtime_error &) { }
+    Fragile::copies_left = -1;
+    assert(are_equal(numbered, source));
+    assert(are_equal(copies < 820 ? numbered : expected, a));
+  }
+}
+
 struct Test
 {
   int m_n;
@@ -324,7 +1524,36 @@ void print_test_cow() {
 
 int main() {
   test_cow();
+  test_inline_storage();
   test_insert_and_erase();
+  test_capacity();
+  test_insert_rows();
+  test_erase_rows();
+  test_insert_pair();
+  test_relocation();
+  test_iterators();
+  test_rows();
+  test_symv<double>();
+  test_symv<float>();
+  test_symv<int>();
+  test_parallel();
+  test_generate();
+  test_bits();
+  test_sparse();
+  test_fixed();
+  test_allocators();
+  test_huge_pages();
+  test_mapped_storage();
+  test_serialization();
+  test_statistics();
+  test_permute();
+  test_min_index();
+  test_tiles();
+  test_versions();
+  test_concurrent_updates<uint64_t>(1);
+  test_concurrent_updates<double>(0.5);
+  test_concurrent_updates<long double>(0.5);
+  test_concurrent_string_updates();
   print_test_exception_safety();
   print_test_cow();
   return 0;
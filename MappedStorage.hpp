@@ -0,0 +1,269 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SSA_POSIX_MAPPING 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace metaprogramming {
+
+// How open_mapped() maps a file. With copy_on_write the array may be
+// written, but pages are copied privately by the kernel on first write and
+// the file never changes. With read_write writes to cells go straight to
+// the file, but the header is never rewritten: insert and erase either
+// shift the elements inside the file or move them out of it into memory,
+// and in both cases the file no longer matches the array. Change the rank
+// of a copy_on_write array and save_mapped() it instead.
+enum class MapMode { copy_on_write, read_write };
+
+namespace ssa {
+
+// Identifies the element type stored in a file.
+template <typename T>
+struct TypeTag;
+
+template <> struct TypeTag<int8_t>   : std::integral_constant<uint32_t, 1> { };
+template <> struct TypeTag<uint8_t>  : std::integral_constant<uint32_t, 2> { };
+template <> struct TypeTag<int16_t>  : std::integral_constant<uint32_t, 3> { };
+template <> struct TypeTag<uint16_t> : std::integral_constant<uint32_t, 4> { };
+template <> struct TypeTag<int32_t>  : std::integral_constant<uint32_t, 5> { };
+template <> struct TypeTag<uint32_t> : std::integral_constant<uint32_t, 6> { };
+template <> struct TypeTag<int64_t>  : std::integral_constant<uint32_t, 7> { };
+template <> struct TypeTag<uint64_t> : std::integral_constant<uint32_t, 8> { };
+template <> struct TypeTag<float>    : std::integral_constant<uint32_t, 9> { };
+template <> struct TypeTag<double>   : std::integral_constant<uint32_t, 10> { };
+
+// Layout of a file: this header, then the packed triangle at data_offset,
+// followed by room for capacity elements in total.
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t type_tag;
+  uint32_t element_size;
+  uint64_t rank;
+  uint64_t capacity;
+  uint64_t data_offset;
+};
+
+constexpr char file_magic[8] = { 'S', 'S', 'A', 'P', 'A', 'C', 'K', 0 };
+constexpr uint32_t file_version = 1;
+constexpr uint32_t file_byte_order = 0x01020304;
+constexpr uint64_t file_data_offset = 64;
+
+static_assert(sizeof(FileHeader) <= file_data_offset, "Header too large");
+
+// Whether the triangle of the given rank, in elements of element_size
+// bytes, has a size in bytes that fits into size_t. Ranks read from files
+// and streams are checked with this before anything is computed from them.
+inline bool is_addressable(uint64_t rank, size_t element_size) {
+  uint64_t max = std::numeric_limits<size_t>::max() / element_size;
+  if (max <= rank) return false;
+  // One of rank and rank + 1 is even, so halve that one first
+  uint64_t lhs = rank % 2 == 0 ? rank / 2 : rank;
+  uint64_t rhs = rank % 2 == 0 ? rank + 1 : (rank + 1) / 2;
+  return lhs == 0 || rhs <= max / lhs;
+}
+
+inline void check_file(bool condition, const std::string & path,
+    const char * what) {
+  if (condition) return;
+  throw std::runtime_error(path + ": " + what);
+}
+
+// Keeps a whole file mapped, or read into memory where mmap is missing.
+class Mapping {
+#ifdef SSA_POSIX_MAPPING
+  void * base;
+#else
+  std::unique_ptr<char[]> contents;
+#endif
+  size_t length;
+
+public:
+  Mapping(const std::string & path, MapMode mode) {
+#ifdef SSA_POSIX_MAPPING
+    bool writable = mode == MapMode::read_write;
+    int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    check_file(fd != -1, path, "cannot open");
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || status.st_size == 0) {
+      ::close(fd);
+      check_file(false, path, "cannot map an empty file");
+    }
+    length = status.st_size;
+    base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+      writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    check_file(base != MAP_FAILED, path, "cannot map");
+#else
+    (void) mode;
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    check_file(bool(in), path, "cannot open");
+    length = in.tellg();
+    contents.reset(new char[length]);
+    in.seekg(0);
+    check_file(bool(in.read(contents.get(), length)), path, "cannot read");
+#endif
+  }
+
+  Mapping(const Mapping &) = delete;
+  Mapping & operator=(const Mapping &) = delete;
+
+  ~Mapping() {
+#ifdef SSA_POSIX_MAPPING
+    ::munmap(base, length);
+#endif
+  }
+
+  char * get() const {
+#ifdef SSA_POSIX_MAPPING
+    return static_cast<char *>(base);
+#else
+    return contents.get();
+#endif
+  }
+
+  size_t get_length() const { return length; }
+};
+
+}
+
+// Allocator of arrays opened with open_mapped(). The element buffer it was
+// created for lives in a file mapping, which stays alive until that buffer
+// is deallocated; everything else comes from std::allocator.
+// Copy-on-write clones get an allocator without the mapping, so they never
+// keep it alive.
+template <typename T>
+class MappedAllocator {
+  template <typename U>
+  friend class MappedAllocator;
+
+  std::shared_ptr<const ssa::Mapping> mapping;
+  const void * data;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  MappedAllocator() noexcept : data(nullptr) { }
+
+  MappedAllocator(std::shared_ptr<const ssa::Mapping> mapping,
+      const void * data) noexcept
+    : mapping(std::move(mapping))
+    , data(data) { }
+
+  // Rebound copies, such as the one allocate_shared() keeps in the control
+  // block of the array, never deallocate the mapped buffer, so they leave
+  // the mapping out rather than keep it alive after a reallocation.
+  template <typename U>
+  MappedAllocator(const MappedAllocator<U> & o) noexcept
+    : data(o.data) { }
+
+  T * allocate(size_t n) { return std::allocator<T>().allocate(n); }
+
+  void deallocate(T * p, size_t n) noexcept {
+    if (p == data) mapping.reset();
+    else std::allocator<T>().deallocate(p, n);
+  }
+
+  MappedAllocator select_on_container_copy_construction() const {
+    return MappedAllocator();
+  }
+
+  // Whether this allocator holds a mapping
+  bool is_mapped() const { return bool(mapping); }
+
+  template <typename U>
+  bool operator==(const MappedAllocator<U> & o) const {
+    return data == o.data;
+  }
+
+  template <typename U>
+  bool operator!=(const MappedAllocator<U> & o) const {
+    return !(*this == o);
+  }
+};
+
+// Writes the packed triangle with a versioned header that open_mapped()
+// understands. Only fixed-size arithmetic element types are supported.
+template <typename ValueType, typename Allocator>
+void save_mapped(const std::string & path,
+    const SymmetricSquareArray<ValueType, Allocator> & array) {
+  size_t rank = array.get_rank();
+  size_t size = (rank + 1) * rank / 2;
+  ssa::FileHeader header = { };
+  std::memcpy(header.magic, ssa::file_magic, sizeof(header.magic));
+  header.version = ssa::file_version;
+  header.byte_order = ssa::file_byte_order;
+  header.type_tag = ssa::TypeTag<ValueType>::value;
+  header.element_size = sizeof(ValueType);
+  header.rank = rank;
+  header.capacity = size;
+  header.data_offset = ssa::file_data_offset;
+  char padding[ssa::file_data_offset] = { };
+  std::memcpy(padding, &header, sizeof(header));
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(padding, sizeof(padding));
+  out.write(reinterpret_cast<const char *>(array.triangle_begin()),
+    size * sizeof(ValueType));
+  out.close();
+  ssa::check_file(bool(out), path, "cannot write");
+}
+
+// Opens a file written by save_mapped() without copying the triangle: the
+// array refers to the mapped pages directly and shares them copy-on-write
+// like any other array. The header has to match ValueType and the byte
+// order of this machine. See MapMode for what read_write allows.
+template <typename ValueType>
+SymmetricSquareArray<ValueType, MappedAllocator<ValueType>> open_mapped(
+    const std::string & path, MapMode mode = MapMode::copy_on_write) {
+  auto mapping = std::make_shared<const ssa::Mapping>(path, mode);
+  size_t length = mapping->get_length();
+  ssa::check_file(sizeof(ssa::FileHeader) <= length, path, "truncated");
+  ssa::FileHeader header;
+  std::memcpy(&header, mapping->get(), sizeof(header));
+  ssa::check_file(
+    0 == std::memcmp(header.magic, ssa::file_magic, sizeof(header.magic)),
+    path, "not a symmetric array file");
+  ssa::check_file(header.version == ssa::file_version, path,
+    "unsupported version");
+  ssa::check_file(header.byte_order == ssa::file_byte_order, path,
+    "written with another byte order");
+  ssa::check_file(header.type_tag == ssa::TypeTag<ValueType>::value
+      && header.element_size == sizeof(ValueType),
+    path, "element type mismatch");
+  ssa::check_file(ssa::is_addressable(header.rank, sizeof(ValueType)), path,
+    "rank too large");
+  size_t size = (header.rank + 1) * header.rank / 2;
+  ssa::check_file(size <= header.capacity
+      && header.data_offset % alignof(ValueType) == 0
+      && header.data_offset <= length
+      && header.capacity <= (length - header.data_offset) / sizeof(ValueType),
+    path, "truncated");
+  ValueType * data =
+    reinterpret_cast<ValueType *>(mapping->get() + header.data_offset);
+  MappedAllocator<ValueType> allocator(mapping, data);
+  return SymmetricSquareArray<ValueType, MappedAllocator<ValueType>>::adopt(
+    header.rank, header.capacity, data, allocator);
+}
+
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace metaprogramming {
+
+// Symmetric array that keeps track of its least off-diagonal cell, as
+// needed by agglomerative clustering. Every cell (row, col) with col < row
+// belongs to row; each row remembers the column of its least cell, and a
+// tournament tree over the rows keeps the overall winner at its root. So
+// argmin() is O(1), a write is O(log n) unless it raises the least cell of
+// its row, which rescans that row, and insert and erase update the index
+// in O(n) plus a rescan of the rows whose least cell was erased. That is
+// O(n) comparisons per rescanned row, so a merge that erases the least
+// cell of many rows costs up to O(n^2) comparisons, not O(n log n). The
+// erase itself moves O(n^2) elements of the packed triangle either way.
+// Ties go to the smaller row, then the smaller column. Writes go through a
+// proxy, like the bit and sparse arrays.
+template <
+  typename ValueType,
+  typename Compare = std::less<ValueType>,
+  typename Allocator = std::allocator<ValueType>>
+class MinIndexedSymmetricSquareArray {
+public:
+  using Array = SymmetricSquareArray<ValueType, Allocator>;
+
+private:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  Array array;
+  Compare compare;
+  // Column of the least cell of every row, npos for row 0
+  std::vector<size_t> row_argmin;
+  // Heap-ordered tree of row numbers over leaves for every row, padded to
+  // a power of two with npos
+  std::vector<size_t> tree;
+  size_t leaf_count;
+
+  static void check_arguments(bool condition) {
+    if (condition) return;
+    throw std::runtime_error("Function was called with wrong arguments");
+  }
+
+  const ValueType * row_begin(size_t row) const {
+    const Array & view = array;
+    return view.triangle_begin() + (row + 1) * row / 2;
+  }
+
+  // Whether cell (row, lhs) beats cell (row, rhs)
+  bool is_better_col(size_t row, size_t lhs, size_t rhs) const {
+    if (rhs == npos) return true;
+    const ValueType * it = row_begin(row);
+    if (compare(it[lhs], it[rhs])) return true;
+    return !compare(it[rhs], it[lhs]) && lhs < rhs;
+  }
+
+  // The row whose least cell wins, where npos loses to any row
+  size_t better_row(size_t lhs, size_t rhs) const {
+    if (lhs == npos) return rhs;
+    if (rhs == npos) return lhs;
+    const ValueType & l = row_begin(lhs)[row_argmin[lhs]];
+    const ValueType & r = row_begin(rhs)[row_argmin[rhs]];
+    if (compare(l, r)) return lhs;
+    if (compare(r, l)) return rhs;
+    return std::min(lhs, rhs);
+  }
+
+  size_t scan_row(size_t row) const {
+    size_t best = npos;
+    for (size_t col = 0; col < row; ++col) {
+      if (is_better_col(row, col, best)) best = col;
+    }
+    return best;
+  }
+
+  void update_leaf(size_t row) {
+    size_t i = leaf_count + row;
+    tree[i] = row_argmin[row] == npos ? npos : row;
+    for (i /= 2; 0 < i; i /= 2) {
+      tree[i] = better_row(tree[2 * i], tree[2 * i + 1]);
+    }
+  }
+
+  void rebuild_tree() {
+    size_t rank = array.get_rank();
+    leaf_count = 1;
+    while (leaf_count < rank) leaf_count *= 2;
+    tree.assign(2 * leaf_count, npos);
+    for (size_t row = 0; row < rank; ++row) {
+      if (row_argmin[row] != npos) tree[leaf_count + row] = row;
+    }
+    for (size_t i = leaf_count - 1; 0 < i; --i) {
+      tree[i] = better_row(tree[2 * i], tree[2 * i + 1]);
+    }
+  }
+
+  // Updates the index after new indices were inserted at the sorted
+  // positions of the resulting array.
+  void index_inserted(const std::vector<size_t> & positions) {
+    size_t rank = array.get_rank();
+    std::vector<size_t> result(rank, npos);
+    auto new_index = [&](size_t old) {
+      for (size_t p : positions) {
+        if (old < p) break;
+        ++old;
+      }
+      return old;
+    };
+    auto inserted = positions.begin();
+    for (size_t row = 0; row < rank; ++row) {
+      if (inserted != positions.end() && *inserted == row) {
+        ++inserted;
+        result[row] = scan_row(row);
+        continue;
+      }
+      size_t old = row - (inserted - positions.begin());
+      size_t best = row_argmin[old];
+      if (best != npos) best = new_index(best);
+      // The new cells of the row are the inserted columns before it
+      for (auto p = positions.begin(); p != inserted; ++p) {
+        if (is_better_col(row, *p, best)) best = *p;
+      }
+      result[row] = best;
+    }
+    row_argmin.swap(result);
+    rebuild_tree();
+  }
+
+  // Updates the index after the sorted indices were erased. Every row whose
+  // least cell was erased is rescanned in full.
+  void index_erased(const std::vector<size_t> & indices) {
+    size_t old_rank = row_argmin.size();
+    std::vector<size_t> new_index(old_rank, npos);
+    for (size_t i = 0, erased = 0; i < old_rank; ++i) {
+      if (erased < indices.size() && indices[erased] == i) ++erased;
+      else new_index[i] = i - erased;
+    }
+    std::vector<size_t> result(array.get_rank(), npos);
+    std::vector<size_t> rescans;
+    for (size_t old = 0; old < old_rank; ++old) {
+      size_t row = new_index[old];
+      if (row == npos) continue;
+      size_t col = row_argmin[old];
+      if (col == npos) continue;
+      if (new_index[col] == npos) rescans.push_back(row);
+      else result[row] = new_index[col];
+    }
+    row_argmin.swap(result);
+    for (size_t row : rescans) row_argmin[row] = scan_row(row);
+    rebuild_tree();
+  }
+
+  void build_index() {
+    row_argmin.assign(array.get_rank(), npos);
+    for (size_t row = 1; row < array.get_rank(); ++row) {
+      row_argmin[row] = scan_row(row);
+    }
+    rebuild_tree();
+  }
+
+public:
+  class Reference {
+    friend class MinIndexedSymmetricSquareArray;
+
+    MinIndexedSymmetricSquareArray * array;
+    size_t row;
+    size_t col;
+
+    Reference(MinIndexedSymmetricSquareArray * array, size_t row, size_t col)
+      : array(array)
+      , row(row)
+      , col(col) { }
+
+  public:
+    operator const ValueType &() const {
+      return static_cast<const MinIndexedSymmetricSquareArray &>(*array)(
+        row, col);
+    }
+
+    Reference & operator=(const ValueType & value) {
+      array->set(row, col, value);
+      return *this;
+    }
+
+    Reference & operator=(const Reference & o) {
+      return *this = static_cast<const ValueType &>(o);
+    }
+  };
+
+  explicit MinIndexedSymmetricSquareArray(Array initial = Array(),
+      Compare compare = Compare())
+      : array(std::move(initial))
+      , compare(compare) {
+    build_index();
+  }
+
+  Reference operator()(size_t row, size_t col) {
+    return Reference(this, row, col);
+  }
+
+  const ValueType & operator()(size_t row, size_t col) const {
+    const Array & view = array;
+    return view(row, col);
+  }
+
+  void set(size_t row, size_t col, const ValueType & value) {
+    if (row < col) std::swap(row, col);
+    check_arguments(row < array.get_rank());
+    size_t best = row_argmin[row];
+    bool is_worse = row != col && best == col
+      && compare((*this)(row, col), value);
+    array(row, col) = value;
+    if (row == col) return;
+    if (is_worse) row_argmin[row] = scan_row(row);
+    else if (best != col && is_better_col(row, col, best)) {
+      row_argmin[row] = col;
+    }
+    update_leaf(row);
+  }
+
+  // Same as SymmetricSquareArray::insert
+  void insert(size_t row, size_t col, const ValueType & val,
+      const ValueType & nil = ValueType()) {
+    if (row < col) std::swap(row, col);
+    array.insert(row, col, val, nil);
+    if (row == col) index_inserted({ row });
+    else index_inserted({ col, row + 1 });
+  }
+
+  void insert_rows(const std::vector<size_t> & positions,
+      const ValueType & val, const ValueType & nil = ValueType()) {
+    array.insert_rows(positions, val, nil);
+    index_inserted(positions);
+  }
+
+  void erase(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    array.erase(row, col);
+    if (row == col) index_erased({ row });
+    else index_erased({ col, row });
+  }
+
+  void erase_rows(const std::vector<size_t> & indices) {
+    array.erase_rows(indices);
+    index_erased(indices);
+  }
+
+  // The least off-diagonal cell as (row, col) with col < row. The array
+  // must have at least rank 2.
+  std::pair<size_t, size_t> argmin() const {
+    size_t row = tree.empty() ? npos : tree[1];
+    check_arguments(row != npos);
+    return { row, row_argmin[row] };
+  }
+
+  const ValueType & min() const {
+    auto cell = argmin();
+    return (*this)(cell.first, cell.second);
+  }
+
+  size_t get_rank() const { return array.get_rank(); }
+
+  // Read-only access; the index would go stale behind mutable access.
+  const Array & get_array() const { return array; }
+};
+
+template <typename ValueType, typename Compare, typename Allocator>
+constexpr size_t
+MinIndexedSymmetricSquareArray<ValueType, Compare, Allocator>::npos;
+
+}
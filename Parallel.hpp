@@ -0,0 +1,99 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace metaprogramming {
+
+// Calls f(row, col, value) for every stored element, i.e. every cell with
+// col <= row.
+template <typename ValueType, typename Allocator, typename F>
+void parallel_for_each(SymmetricSquareArray<ValueType, Allocator> & array,
+    F f, ThreadPool & pool = default_thread_pool()) {
+  ValueType * data = array.triangle_begin();
+  ssa::for_each_chunk(array.get_rank(), pool,
+    [&](size_t first, size_t last) {
+      ValueType * it = data + first * (first + 1) / 2;
+      for (size_t row = first; row < last; ++row) {
+        for (size_t col = 0; col <= row; ++col, ++it) f(row, col, *it);
+      }
+    });
+}
+
+// Replaces every stored element by f(element).
+template <typename ValueType, typename Allocator, typename F>
+void parallel_transform(SymmetricSquareArray<ValueType, Allocator> & array,
+    F f, ThreadPool & pool = default_thread_pool()) {
+  ValueType * data = array.triangle_begin();
+  ssa::for_each_chunk(array.get_rank(), pool,
+    [&](size_t first, size_t last) {
+      std::transform(data + first * (first + 1) / 2,
+        data + last * (last + 1) / 2,
+        data + first * (first + 1) / 2,
+        f);
+    });
+}
+
+// Folds every stored element (each off-diagonal pair once) with an
+// associative op. Partial results are combined in row order.
+template <typename ValueType, typename Allocator, typename T, typename Op>
+T parallel_reduce(const SymmetricSquareArray<ValueType, Allocator> & array,
+    T init, Op op, ThreadPool & pool = default_thread_pool()) {
+  const ValueType * data = array.triangle_begin();
+  std::vector<size_t> bounds = ssa::partition_rows(array.get_rank(), pool);
+  size_t chunks = bounds.size() - 1;
+  std::vector<std::unique_ptr<T>> partial(chunks);
+  auto reduce = [&](size_t k) {
+    const ValueType * it = data + bounds[k] * (bounds[k] + 1) / 2;
+    const ValueType * end = data + bounds[k + 1] * (bounds[k + 1] + 1) / 2;
+    if (it == end) return;
+    T result = *it;
+    while (++it != end) result = op(std::move(result), *it);
+    partial[k].reset(new T(std::move(result)));
+  };
+  if (chunks == 1) reduce(0);
+  else pool.run(chunks, reduce);
+  for (auto & p : partial) {
+    if (p) init = op(std::move(init), std::move(*p));
+  }
+  return init;
+}
+
+// Parallel y = alpha * A * x + beta * y. Every chunk accumulates into its
+// own vector, which are then summed column-wise.
+template <typename ValueType, typename Allocator>
+void parallel_symv(const SymmetricSquareArray<ValueType, Allocator> & array,
+    const ValueType * x, ValueType * y,
+    ValueType alpha = ValueType(1), ValueType beta = ValueType(0),
+    ThreadPool & pool = default_thread_pool()) {
+  size_t rank = array.get_rank();
+  const ValueType * data = array.triangle_begin();
+  std::vector<size_t> bounds = ssa::partition_rows(rank, pool);
+  size_t chunks = bounds.size() - 1;
+  if (chunks == 1) {
+    ssa::symv(rank, data, x, y, alpha, beta);
+    return;
+  }
+  std::vector<std::vector<ValueType>> partial(chunks);
+  pool.run(chunks, [&](size_t k) {
+    partial[k].assign(bounds[k + 1], ValueType(0));
+    ssa::symv_rows(bounds[k], bounds[k + 1], data, x,
+      partial[k].data(), alpha);
+  });
+  pool.run(chunks, [&](size_t k) {
+    size_t first = rank * k / chunks;
+    size_t last = rank * (k + 1) / chunks;
+    ssa::scale(last - first, y + first, beta);
+    for (auto & p : partial) {
+      for (size_t i = first; i < std::min(last, p.size()); ++i) y[i] += p[i];
+    }
+  });
+}
+
+}
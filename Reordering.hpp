@@ -0,0 +1,79 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <vector>
+
+namespace metaprogramming {
+
+// Greatest |row - col| over the cells that differ from nil, 0 if there
+// are none off the diagonal.
+template <typename ValueType, typename Allocator>
+size_t bandwidth(const SymmetricSquareArray<ValueType, Allocator> & array,
+    const ValueType & nil = ValueType()) {
+  size_t result = 0;
+  const ValueType * it = array.triangle_begin();
+  for (size_t row = 0; row < array.get_rank(); ++row) {
+    for (size_t col = 0; col <= row; ++col, ++it) {
+      if (!(*it == nil)) result = std::max(result, row - col);
+    }
+  }
+  return result;
+}
+
+// Reverse Cuthill-McKee order of the graph whose edges are the off-diagonal
+// cells that differ from nil. Every connected component is walked breadth
+// first from a vertex of least degree, visiting neighbours by increasing
+// degree, and the whole order is reversed at the end. The result is meant
+// for permute(): element k is the old index placed at k, and the permuted
+// array tends to have its non-nil cells close to the diagonal.
+template <typename ValueType, typename Allocator>
+std::vector<size_t> reverse_cuthill_mckee(
+    const SymmetricSquareArray<ValueType, Allocator> & array,
+    const ValueType & nil = ValueType()) {
+  size_t rank = array.get_rank();
+  std::vector<std::vector<size_t>> neighbours(rank);
+  const ValueType * it = array.triangle_begin();
+  for (size_t row = 0; row < rank; ++row) {
+    for (size_t col = 0; col < row; ++col, ++it) {
+      if (*it == nil) continue;
+      neighbours[row].push_back(col);
+      neighbours[col].push_back(row);
+    }
+    ++it;
+  }
+  auto by_degree = [&](size_t lhs, size_t rhs) {
+    size_t l = neighbours[lhs].size();
+    size_t r = neighbours[rhs].size();
+    return l < r || (l == r && lhs < rhs);
+  };
+  std::vector<size_t> vertices(rank);
+  for (size_t i = 0; i < rank; ++i) vertices[i] = i;
+  std::sort(vertices.begin(), vertices.end(), by_degree);
+  for (auto & list : neighbours) {
+    std::sort(list.begin(), list.end(), by_degree);
+  }
+
+  std::vector<size_t> order;
+  order.reserve(rank);
+  std::vector<bool> visited(rank);
+  for (size_t start : vertices) {
+    if (visited[start]) continue;
+    visited[start] = true;
+    order.push_back(start);
+    for (size_t head = order.size() - 1; head < order.size(); ++head) {
+      for (size_t next : neighbours[order[head]]) {
+        if (visited[next]) continue;
+        visited[next] = true;
+        order.push_back(next);
+      }
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+}
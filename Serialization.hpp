@@ -0,0 +1,386 @@
+#pragma once
+
+#include "MappedStorage.hpp"
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace metaprogramming {
+
+// How write() stores chunks. shuffle_lz groups the i-th bytes of all
+// elements together, which turns the similar high bytes of neighbouring
+// numbers into long runs, then compresses them with a small LZ77 coder in
+// the style of LZ4. Chunks that do not shrink are stored as they are.
+enum class Compression : uint32_t { none = 0, shuffle_lz = 1 };
+
+namespace ssa {
+
+struct StreamHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t type_tag;
+  uint32_t element_size;
+  uint64_t rank;
+  uint32_t compression;
+  uint32_t reserved;
+};
+
+// Precedes every chunk of rows [first_row, first_row + row_count). The
+// checksum covers the raw elements, so it also catches a bad decoder.
+struct ChunkHeader {
+  uint64_t first_row;
+  uint64_t row_count;
+  uint64_t raw_bytes;
+  uint64_t stored_bytes;
+  uint64_t checksum;
+  uint32_t compression;
+  uint32_t reserved;
+};
+
+// read() rejects streams of a greater rank before allocating, so that a
+// corrupt header cannot ask for an absurd amount of memory. The triangle
+// of this rank still has about 5.5e11 elements, so on a seekable stream
+// read() also checks the rank against the bytes that are left.
+constexpr uint64_t stream_max_rank = uint64_t(1) << 20;
+
+constexpr char stream_magic[8] = { 'S', 'S', 'A', 'S', 'T', 'R', 'M', 0 };
+constexpr uint32_t stream_version = 1;
+
+inline void check_stream(bool condition, const char * what) {
+  if (condition) return;
+  throw std::runtime_error(std::string("stream: ") + what);
+}
+
+// Multiplicative hash over 64-bit words, then the tail bytes
+inline uint64_t checksum(const char * p, size_t n) {
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t h = 0xcbf29ce484222325ull ^ n;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, p + i, 8);
+    h = (h ^ word) * prime;
+    h ^= h >> 29;
+  }
+  for (; i < n; ++i) h = (h ^ uint8_t(p[i])) * prime;
+  return h ^ (h >> 32);
+}
+
+// Byte i of element k goes to position i * count + k.
+inline void shuffle(const char * in, char * out, size_t count, size_t width) {
+  for (size_t k = 0; k < count; ++k) {
+    for (size_t i = 0; i < width; ++i) out[i * count + k] = in[k * width + i];
+  }
+}
+
+inline void unshuffle(const char * in, char * out, size_t count,
+    size_t width) {
+  for (size_t i = 0; i < width; ++i) {
+    for (size_t k = 0; k < count; ++k) out[k * width + i] = in[i * count + k];
+  }
+}
+
+// Sequences of literals followed by a back reference: a token holding both
+// lengths in its nibbles (15 meaning more length bytes follow, each adding
+// up to 255), the literals, a 16-bit little-endian offset and the match
+// length minus 4. The last sequence has literals only.
+class LzCoder {
+  static constexpr size_t min_match = 4;
+  static constexpr size_t hash_bits = 14;
+
+  static uint32_t load32(const uint8_t * p) {
+    uint32_t x;
+    std::memcpy(&x, p, 4);
+    return x;
+  }
+
+  static bool put_length(uint8_t *& op, uint8_t * end, size_t n) {
+    for (; n >= 255; n -= 255) {
+      if (op == end) return false;
+      *op++ = 255;
+    }
+    if (op == end) return false;
+    *op++ = uint8_t(n);
+    return true;
+  }
+
+  static size_t get_length(const uint8_t *& ip, const uint8_t * end,
+      size_t nibble) {
+    size_t n = nibble;
+    if (nibble != 15) return n;
+    for (;;) {
+      check_stream(ip != end, "corrupt chunk");
+      uint8_t b = *ip++;
+      n += b;
+      if (b != 255) return n;
+    }
+  }
+
+  // Writes literals [anchor, anchor + count) and, unless it is the last
+  // sequence, a match. Fails if the output is full.
+  static bool put_sequence(uint8_t *& op, uint8_t * end,
+      const uint8_t * literals, size_t count,
+      size_t offset, size_t match) {
+    if (op == end) return false;
+    uint8_t * token = op++;
+    size_t m = offset ? match - min_match : 0;
+    *token = uint8_t((std::min<size_t>(count, 15) << 4)
+      | std::min<size_t>(m, 15));
+    if (count >= 15 && !put_length(op, end, count - 15)) return false;
+    if (size_t(end - op) < count) return false;
+    std::memcpy(op, literals, count);
+    op += count;
+    if (!offset) return true;
+    if (end - op < 2) return false;
+    *op++ = uint8_t(offset);
+    *op++ = uint8_t(offset >> 8);
+    return m < 15 || put_length(op, end, m - 15);
+  }
+
+public:
+  // decompress() produces fewer bytes than this per input byte: a match
+  // costs at least 3 bytes for at most 19 bytes of output, and every
+  // further length byte adds at most 255.
+  static constexpr uint64_t max_ratio = 255;
+
+  // Returns the compressed size, or 0 if it would not fit into capacity.
+  static size_t compress(const char * input, size_t n,
+      char * output, size_t capacity) {
+    const uint8_t * in = reinterpret_cast<const uint8_t *>(input);
+    uint8_t * op = reinterpret_cast<uint8_t *>(output);
+    uint8_t * end = op + capacity;
+    std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + min_match <= n) {
+      uint32_t sequence = load32(in + i);
+      uint32_t & slot = table[(sequence * 2654435761u) >> (32 - hash_bits)];
+      size_t candidate = slot;
+      slot = uint32_t(i + 1);
+      if (!candidate || i + 1 - candidate > 0xffff
+          || load32(in + candidate - 1) != sequence) {
+        ++i;
+        continue;
+      }
+      size_t from = candidate - 1;
+      size_t length = min_match;
+      while (i + length < n && in[from + length] == in[i + length]) ++length;
+      if (!put_sequence(op, end, in + anchor, i - anchor, i - from, length)) {
+        return 0;
+      }
+      i += length;
+      anchor = i;
+    }
+    if (!put_sequence(op, end, in + anchor, n - anchor, 0, 0)) return 0;
+    return op - reinterpret_cast<uint8_t *>(output);
+  }
+
+  // Decodes exactly n bytes, throwing on malformed input.
+  static void decompress(const char * input, size_t size,
+      char * output, size_t n) {
+    const uint8_t * ip = reinterpret_cast<const uint8_t *>(input);
+    const uint8_t * in_end = ip + size;
+    uint8_t * out = reinterpret_cast<uint8_t *>(output);
+    size_t o = 0;
+    while (ip != in_end) {
+      uint8_t token = *ip++;
+      size_t count = get_length(ip, in_end, token >> 4);
+      check_stream(count <= size_t(in_end - ip) && count <= n - o,
+        "corrupt chunk");
+      std::memcpy(out + o, ip, count);
+      ip += count;
+      o += count;
+      if (ip == in_end) break;
+      check_stream(in_end - ip >= 2, "corrupt chunk");
+      size_t offset = ip[0] | size_t(ip[1]) << 8;
+      ip += 2;
+      size_t length = get_length(ip, in_end, token & 15) + min_match;
+      check_stream(offset && offset <= o && length <= n - o,
+        "corrupt chunk");
+      // An overlapping match repeats the last offset bytes; copying the
+      // whole repeated part each round doubles the step.
+      size_t from = o - offset;
+      while (length) {
+        size_t step = std::min(length, o - from);
+        std::memcpy(out + o, out + from, step);
+        o += step;
+        length -= step;
+      }
+    }
+    check_stream(o == n, "corrupt chunk");
+  }
+};
+
+// Bytes between the read position and the end of in, or -1 if in cannot
+// seek, e.g. a pipe. The read position is left where it was.
+inline std::streamoff bytes_left(std::istream & in) {
+  std::streampos here = in.tellg();
+  if (here == std::streampos(-1)) return -1;
+  std::streampos end = in.rdbuf()->pubseekoff(0, std::ios::end, std::ios::in);
+  if (end == std::streampos(-1)
+      || in.rdbuf()->pubseekpos(here, std::ios::in) != here) {
+    return -1;
+  }
+  return end - here;
+}
+
+}
+
+// Writes the array as a stream header followed by chunks of whole rows of
+// about chunk_bytes each, every one with its own checksum. Only the
+// fixed-size arithmetic element types of save_mapped() are supported.
+template <typename ValueType, typename Allocator>
+void write(std::ostream & out,
+    const SymmetricSquareArray<ValueType, Allocator> & array,
+    Compression compression = Compression::none,
+    size_t chunk_bytes = size_t(1) << 20) {
+  size_t rank = array.get_rank();
+  ssa::StreamHeader header = { };
+  std::memcpy(header.magic, ssa::stream_magic, sizeof(header.magic));
+  header.version = ssa::stream_version;
+  header.byte_order = ssa::file_byte_order;
+  header.type_tag = ssa::TypeTag<ValueType>::value;
+  header.element_size = sizeof(ValueType);
+  header.rank = rank;
+  header.compression = uint32_t(compression);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  const char * data = reinterpret_cast<const char *>(array.triangle_begin());
+  std::vector<char> shuffled;
+  std::vector<char> packed;
+  for (size_t first = 0; first < rank; ) {
+    size_t begin = (first + 1) * first / 2;
+    size_t last = first + 1;
+    while (last < rank
+        && ((last + 1) * last / 2 - begin) * sizeof(ValueType) < chunk_bytes) {
+      ++last;
+    }
+    size_t count = (last + 1) * last / 2 - begin;
+    ssa::ChunkHeader chunk = { };
+    chunk.first_row = first;
+    chunk.row_count = last - first;
+    chunk.raw_bytes = count * sizeof(ValueType);
+    chunk.checksum = ssa::checksum(data + begin * sizeof(ValueType),
+      chunk.raw_bytes);
+    const char * payload = data + begin * sizeof(ValueType);
+    chunk.stored_bytes = chunk.raw_bytes;
+    if (compression == Compression::shuffle_lz) {
+      shuffled.resize(chunk.raw_bytes);
+      packed.resize(chunk.raw_bytes);
+      ssa::shuffle(payload, shuffled.data(), count, sizeof(ValueType));
+      size_t size = ssa::LzCoder::compress(shuffled.data(), chunk.raw_bytes,
+        packed.data(), packed.size());
+      if (size && size < chunk.raw_bytes) {
+        chunk.compression = uint32_t(compression);
+        chunk.stored_bytes = size;
+        payload = packed.data();
+      }
+    }
+    out.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+    out.write(payload, chunk.stored_bytes);
+    first = last;
+  }
+  ssa::check_stream(bool(out), "cannot write");
+}
+
+// Reads what write() produced. Chunks are decoded straight into the
+// uninitialized element buffer, so apart from the array itself only one
+// chunk's worth of scratch memory is needed. On a stream that cannot seek
+// only stream_max_rank bounds what a corrupt header can make it allocate.
+template <typename ValueType, typename Allocator = std::allocator<ValueType>>
+SymmetricSquareArray<ValueType, Allocator> read(std::istream & in,
+    Allocator allocator = Allocator()) {
+  static_assert(std::is_trivially_copyable<ValueType>::value,
+    "Elements are read as raw bytes");
+  using AllocatorTraits = std::allocator_traits<Allocator>;
+  auto read_bytes = [&](void * p, size_t n) {
+    ssa::check_stream(bool(in.read(static_cast<char *>(p), n)),
+      "unexpected end");
+  };
+  ssa::StreamHeader header;
+  read_bytes(&header, sizeof(header));
+  ssa::check_stream(
+    0 == std::memcmp(header.magic, ssa::stream_magic, sizeof(header.magic)),
+    "not a symmetric array stream");
+  ssa::check_stream(header.version == ssa::stream_version,
+    "unsupported version");
+  ssa::check_stream(header.byte_order == ssa::file_byte_order,
+    "written with another byte order");
+  ssa::check_stream(header.type_tag == ssa::TypeTag<ValueType>::value
+      && header.element_size == sizeof(ValueType),
+    "element type mismatch");
+  ssa::check_stream(header.compression == uint32_t(Compression::none)
+      || header.compression == uint32_t(Compression::shuffle_lz),
+    "bad stream encoding");
+  ssa::check_stream(header.rank <= ssa::stream_max_rank
+      && ssa::is_addressable(header.rank, sizeof(ValueType)),
+    "rank too large");
+  size_t rank = header.rank;
+  size_t size = (rank + 1) * rank / 2;
+  // The chunks have to be there before their memory is, assuming the best
+  // compression the coder can achieve
+  std::streamoff left = ssa::bytes_left(in);
+  if (rank && left >= 0) {
+    uint64_t payload = uint64_t(size) * sizeof(ValueType);
+    if (header.compression == uint32_t(Compression::shuffle_lz)) {
+      payload /= ssa::LzCoder::max_ratio;
+    }
+    ssa::check_stream(sizeof(ssa::ChunkHeader) + payload <= uint64_t(left),
+      "rank exceeds the stream");
+  }
+  ValueType * data = AllocatorTraits::allocate(allocator, size);
+  try {
+    std::vector<char> packed;
+    std::vector<char> shuffled;
+    for (size_t first = 0; first < rank; ) {
+      ssa::ChunkHeader chunk;
+      read_bytes(&chunk, sizeof(chunk));
+      size_t last = first + chunk.row_count;
+      ssa::check_stream(chunk.first_row == first
+          && 0 < chunk.row_count && chunk.row_count <= rank - first,
+        "rows out of order");
+      size_t begin = (first + 1) * first / 2;
+      size_t count = (last + 1) * last / 2 - begin;
+      ssa::check_stream(chunk.raw_bytes == count * sizeof(ValueType),
+        "bad chunk size");
+      char * target = reinterpret_cast<char *>(data + begin);
+      if (chunk.compression == uint32_t(Compression::none)) {
+        ssa::check_stream(chunk.stored_bytes == chunk.raw_bytes,
+          "bad chunk size");
+        read_bytes(target, chunk.raw_bytes);
+      } else {
+        ssa::check_stream(chunk.compression == header.compression
+            && chunk.stored_bytes < chunk.raw_bytes,
+          "bad chunk encoding");
+        packed.resize(chunk.stored_bytes);
+        shuffled.resize(chunk.raw_bytes);
+        read_bytes(packed.data(), packed.size());
+        ssa::LzCoder::decompress(packed.data(), packed.size(),
+          shuffled.data(), shuffled.size());
+        ssa::unshuffle(shuffled.data(), target, count, sizeof(ValueType));
+      }
+      ssa::check_stream(
+        ssa::checksum(target, chunk.raw_bytes) == chunk.checksum,
+        "checksum mismatch");
+      first = last;
+    }
+  } catch (...) {
+    AllocatorTraits::deallocate(allocator, data, size);
+    throw;
+  }
+  return SymmetricSquareArray<ValueType, Allocator>::adopt(
+    rank, size, data, allocator);
+}
+
+}
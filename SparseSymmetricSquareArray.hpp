@@ -0,0 +1,405 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace metaprogramming {
+
+namespace ssa {
+
+// Lower triangle in compressed sparse row form: the entries of row r are
+// columns[offsets[r], offsets[r + 1]), sorted, all of them <= r, with their
+// values alongside. Cells that are not stored read as nil.
+template <typename ValueType, typename Allocator>
+struct SparseHolder {
+  using IndexAllocator = typename std::allocator_traits<Allocator>::
+    template rebind_alloc<size_t>;
+
+  size_t rank;
+  ValueType nil;
+  std::vector<size_t, IndexAllocator> offsets;
+  std::vector<size_t, IndexAllocator> columns;
+  std::vector<ValueType, Allocator> values;
+
+  SparseHolder(size_t rank, const ValueType & nil, Allocator allocator)
+    : rank(rank)
+    , nil(nil)
+    , offsets(rank + 1, 0, IndexAllocator(allocator))
+    , columns(IndexAllocator(allocator))
+    , values(allocator) { }
+};
+
+}
+
+// Sparse layout: only cells that differ from nil are stored, so memory and
+// iteration are proportional to their number. Keeps the semantics of the
+// dense array, with nil fixed per array instead of per call: cells written
+// with a value equal to nil are dropped again. ValueType has to be equality
+// comparable. As with the bit array, mutable access goes through proxies,
+// which lets copies stay shared until one of them is written.
+template <typename ValueType, typename Allocator>
+class SymmetricSquareArray<ValueType, Allocator, ssa::SparseLayout> {
+  using HolderType = ssa::SparseHolder<ValueType, Allocator>;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  std::shared_ptr<HolderType> holder;
+
+  static void check_arguments(bool condition) {
+    if (condition) return;
+    throw std::runtime_error("Function was called with wrong arguments");
+  }
+
+  // Position of (row, col), row >= col, in columns, or where it would go
+  size_t lower_bound(size_t row, size_t col) const {
+    auto begin = holder->columns.begin();
+    return std::lower_bound(begin + holder->offsets[row],
+      begin + holder->offsets[row + 1], col) - begin;
+  }
+
+  void ensure_unique() {
+    if (holder.unique()) return;
+    holder = std::allocate_shared<HolderType>(get_allocator(), *holder);
+  }
+
+  std::shared_ptr<HolderType> make_holder(size_t rank) const {
+    return std::allocate_shared<HolderType>(
+      get_allocator(), rank, holder->nil, get_allocator());
+  }
+
+  static void push(HolderType & next, size_t col, const ValueType & value) {
+    if (value == next.nil) return;
+    next.columns.push_back(col);
+    next.values.push_back(value);
+  }
+
+  // Inserts new indices at the sorted positions of the resulting array.
+  // Cells in the new rows and columns are fill(row, col); old entries are
+  // carried over with their columns renumbered.
+  template <typename Fill>
+  void insert_indices(const std::vector<size_t> & positions, Fill fill) {
+    size_t new_rank = get_rank() + positions.size();
+    for (size_t i = 0; i < positions.size(); ++i) {
+      check_arguments(positions[i] < new_rank
+          && (i == 0 || positions[i - 1] < positions[i]));
+    }
+    std::vector<size_t> old(new_rank, size_t(npos));
+    std::vector<size_t> renumbered(get_rank());
+    auto it = positions.begin();
+    for (size_t r = 0, o = 0; r < new_rank; ++r) {
+      if (it != positions.end() && *it == r) ++it;
+      else renumbered[old[r] = o++] = r;
+    }
+    const HolderType & from = *holder;
+    auto next = make_holder(new_rank);
+    for (size_t r = 0; r < new_rank; ++r) {
+      if (old[r] == npos) {
+        for (size_t c = 0; c <= r; ++c) push(*next, c, fill(r, c));
+      } else {
+        // Merge the old entries with the new columns, both sorted
+        auto p = positions.begin();
+        for (size_t i = from.offsets[old[r]];
+            i < from.offsets[old[r] + 1]; ++i) {
+          size_t c = renumbered[from.columns[i]];
+          for (; p != positions.end() && *p < c; ++p) {
+            push(*next, *p, fill(r, *p));
+          }
+          next->columns.push_back(c);
+          next->values.push_back(from.values[i]);
+        }
+        for (; p != positions.end() && *p < r; ++p) {
+          push(*next, *p, fill(r, *p));
+        }
+      }
+      next->offsets[r + 1] = next->columns.size();
+    }
+    holder = std::move(next);
+  }
+
+  // Keeps only the given (increasing) indices.
+  void compact(const std::vector<size_t> & kept) {
+    std::vector<size_t> renumbered(get_rank(), size_t(npos));
+    for (size_t i = 0; i < kept.size(); ++i) renumbered[kept[i]] = i;
+    const HolderType & from = *holder;
+    auto next = make_holder(kept.size());
+    for (size_t r = 0; r < kept.size(); ++r) {
+      for (size_t i = from.offsets[kept[r]];
+          i < from.offsets[kept[r] + 1]; ++i) {
+        size_t c = renumbered[from.columns[i]];
+        if (c == npos) continue;
+        next->columns.push_back(c);
+        next->values.push_back(from.values[i]);
+      }
+      next->offsets[r + 1] = next->columns.size();
+    }
+    holder = std::move(next);
+  }
+
+public:
+  using allocator_type = Allocator;
+
+  // Proxy for one cell. Writing through it unshares the array first.
+  class Reference {
+    friend class SymmetricSquareArray;
+
+    SymmetricSquareArray * array;
+    size_t row;
+    size_t col;
+
+    Reference(SymmetricSquareArray * array, size_t row, size_t col)
+      : array(array)
+      , row(row)
+      , col(col) { }
+
+  public:
+    operator const ValueType &() const {
+      return static_cast<const SymmetricSquareArray &>(*array)(row, col);
+    }
+
+    Reference & operator=(const ValueType & value) {
+      array->set(row, col, value);
+      return *this;
+    }
+
+    Reference & operator=(const Reference & o) {
+      return *this = static_cast<const ValueType &>(o);
+    }
+  };
+
+  // Walks the stored entries in row-major order of the lower triangle.
+  class ConstIterator {
+    friend class SymmetricSquareArray;
+
+    const HolderType * holder;
+    size_t index;
+    size_t current_row;
+
+    ConstIterator(const HolderType * holder, size_t index)
+      : holder(holder)
+      , index(index)
+      , current_row(0) {
+      skip_rows();
+    }
+
+    void skip_rows() {
+      while (current_row < holder->rank
+          && holder->offsets[current_row + 1] <= index) {
+        ++current_row;
+      }
+    }
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = ValueType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const ValueType *;
+    using reference         = const ValueType &;
+
+    size_t row() const { return current_row; }
+    size_t col() const { return holder->columns[index]; }
+
+    reference operator*() const { return holder->values[index]; }
+    pointer operator->() const { return &holder->values[index]; }
+
+    ConstIterator & operator++() {
+      ++index;
+      skip_rows();
+      return *this;
+    }
+
+    ConstIterator operator++(int) {
+      ConstIterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const ConstIterator & o) const {
+      return index == o.index;
+    }
+
+    bool operator!=(const ConstIterator & o) const { return !(*this == o); }
+  };
+
+  SymmetricSquareArray(Allocator allocator = Allocator())
+    : SymmetricSquareArray(0, ValueType(), allocator) { }
+
+  SymmetricSquareArray(size_t rank, Allocator allocator = Allocator())
+    : SymmetricSquareArray(rank, ValueType(), allocator) { }
+
+  SymmetricSquareArray(size_t rank, const ValueType & nil,
+      Allocator allocator = Allocator())
+    : holder(
+      std::allocate_shared<HolderType>(allocator, rank, nil, allocator)) { }
+
+  // Stores the cells of a dense array that differ from nil.
+  template <typename OtherAllocator>
+  explicit SymmetricSquareArray(
+      const SymmetricSquareArray<ValueType, OtherAllocator> & dense,
+      const ValueType & nil = ValueType(),
+      Allocator allocator = Allocator())
+    : SymmetricSquareArray(dense.get_rank(), nil, allocator) {
+    const ValueType * it = dense.triangle_begin();
+    for (size_t row = 0; row < get_rank(); ++row) {
+      for (size_t col = 0; col <= row; ++col, ++it) push(*holder, col, *it);
+      holder->offsets[row + 1] = holder->columns.size();
+    }
+  }
+
+  SymmetricSquareArray(const SymmetricSquareArray &) = default;
+  SymmetricSquareArray(SymmetricSquareArray &&) = default;
+
+  SymmetricSquareArray & operator=(SymmetricSquareArray o) {
+    swap(*this, o);
+    return *this;
+  }
+
+  static void swap(SymmetricSquareArray & lhs, SymmetricSquareArray & rhs) {
+    std::swap(lhs.holder, rhs.holder);
+  }
+
+  // Copies the contents into the dense packed layout.
+  template <typename OtherAllocator = Allocator>
+  SymmetricSquareArray<ValueType, OtherAllocator> to_dense(
+      OtherAllocator allocator = OtherAllocator()) const {
+    // Cells come in row order, so the stored entries are walked once
+    size_t k = 0;
+    return SymmetricSquareArray<ValueType, OtherAllocator>::from_function(
+      get_rank(),
+      [&](size_t row, size_t col) -> const ValueType & {
+        if (k == holder->offsets[row + 1] || holder->columns[k] != col) {
+          return holder->nil;
+        }
+        return holder->values[k++];
+      },
+      allocator);
+  }
+
+  const ValueType & operator()(size_t row, size_t col) const {
+    if (row < col) std::swap(row, col);
+    size_t i = lower_bound(row, col);
+    if (i != holder->offsets[row + 1] && holder->columns[i] == col) {
+      return holder->values[i];
+    }
+    return holder->nil;
+  }
+
+  Reference operator()(size_t row, size_t col) {
+    return Reference(this, row, col);
+  }
+
+  // Writes one cell. Writing nil removes the entry.
+  void set(size_t row, size_t col, const ValueType & value) {
+    if (row < col) std::swap(row, col);
+    check_arguments(row < get_rank());
+    ensure_unique();
+    HolderType & h = *holder;
+    size_t i = lower_bound(row, col);
+    bool found = i != h.offsets[row + 1] && h.columns[i] == col;
+    if (found && !(value == h.nil)) {
+      h.values[i] = value;
+    } else if (found) {
+      h.columns.erase(h.columns.begin() + i);
+      h.values.erase(h.values.begin() + i);
+      for (size_t r = row + 1; r <= h.rank; ++r) --h.offsets[r];
+    } else if (!(value == h.nil)) {
+      h.values.insert(h.values.begin() + i, value);
+      h.columns.insert(h.columns.begin() + i, col);
+      for (size_t r = row + 1; r <= h.rank; ++r) ++h.offsets[r];
+    }
+  }
+
+  // New cells are nil unless given otherwise.
+  void insert(size_t row, size_t col, const ValueType & val) {
+    insert(row, col, val, ValueType(get_nil()));
+  }
+
+  void insert(size_t row, size_t col,
+      const ValueType & val, const ValueType & nil) {
+    if (row < col) std::swap(row, col);
+    if (row != col) {
+      insert_indices({ col, row + 1 },
+        [&](size_t r, size_t c) -> const ValueType & {
+          return r == row + 1 && c == col ? val : nil;
+        });
+    } else {
+      insert_indices({ row },
+        [&](size_t r, size_t c) -> const ValueType & {
+          return r == c ? val : nil;
+        });
+    }
+  }
+
+  void insert_rows(const std::vector<size_t> & positions,
+      const ValueType & val) {
+    insert_rows(positions, val, ValueType(get_nil()));
+  }
+
+  void insert_rows(const std::vector<size_t> & positions,
+      const ValueType & val, const ValueType & nil) {
+    insert_indices(positions, [&](size_t r, size_t c) -> const ValueType & {
+      return r == c ? val : nil;
+    });
+  }
+
+  void erase(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    if (row != col) erase_rows({ col, row });
+    else            erase_rows({ row });
+  }
+
+  void erase_rows(const std::vector<size_t> & indices) {
+    size_t rank = get_rank();
+    for (size_t i = 0; i < indices.size(); ++i) {
+      check_arguments(indices[i] < rank
+          && (i == 0 || indices[i - 1] < indices[i]));
+    }
+    std::vector<size_t> kept;
+    kept.reserve(rank - indices.size());
+    auto it = indices.begin();
+    for (size_t i = 0; i < rank; ++i) {
+      if (it != indices.end() && *it == i) ++it;
+      else kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  template <typename Predicate>
+  void erase_rows_if(Predicate pred) {
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < get_rank(); ++i) {
+      if (!pred(i)) kept.push_back(i);
+    }
+    compact(kept);
+  }
+
+  ConstIterator begin() const { return ConstIterator(holder.get(), 0); }
+
+  ConstIterator end() const {
+    return ConstIterator(holder.get(), holder->columns.size());
+  }
+
+  ConstIterator cbegin() const { return begin(); }
+  ConstIterator cend()   const { return end(); }
+
+  size_t get_rank() const { return holder->rank; }
+
+  // Number of stored, i.e. non-nil, cells of the lower triangle
+  size_t get_entry_count() const { return holder->columns.size(); }
+
+  const ValueType & get_nil() const { return holder->nil; }
+
+  Allocator get_allocator() const { return holder->values.get_allocator(); }
+
+  long get_reference_count() const { return holder.use_count(); }
+  bool get_is_sharable() const { return true; }
+};
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+namespace metaprogramming {
+
+// What the statistics count. Constructed, copied and destroyed elements
+// enter or leave an array, so constructed + copied - destroyed is the number
+// of live ones. Moved counts elements that insert, erase or a reallocation
+// relocates, whether by move or as raw bytes. Clones are deep copies made by
+// copy-on-write or by copying an unsharable array.
+enum class Counter {
+  allocations,
+  bytes_allocated,
+  elements_constructed,
+  elements_copied,
+  elements_moved,
+  elements_destroyed,
+  clones,
+  sharing_changes
+};
+
+namespace ssa {
+
+constexpr size_t counter_count = size_t(Counter::sharing_changes) + 1;
+
+}
+
+// A snapshot of the counters, cheap to take and copy
+struct Statistics {
+  uint64_t values[ssa::counter_count] = { };
+
+  uint64_t operator[](Counter counter) const {
+    return values[size_t(counter)];
+  }
+
+  // Stable names for exporting, e.g. "elements_moved"
+  static const char * name(Counter counter) {
+    static const char * const names[ssa::counter_count] = {
+      "allocations",
+      "bytes_allocated",
+      "elements_constructed",
+      "elements_copied",
+      "elements_moved",
+      "elements_destroyed",
+      "clones",
+      "sharing_changes"
+    };
+    return names[size_t(counter)];
+  }
+};
+
+// Counting is compiled in with -DSSA_STATISTICS. Without it the counters
+// are empty classes whose functions do nothing, so arrays keep their size
+// and every call disappears.
+#ifdef SSA_STATISTICS
+constexpr bool statistics_enabled = true;
+#else
+constexpr bool statistics_enabled = false;
+#endif
+
+namespace ssa {
+
+#ifdef SSA_STATISTICS
+
+// Totals over all arrays of every type, updated with relaxed atomics
+template <typename = void>
+struct GlobalCounters {
+  static std::atomic<uint64_t> values[counter_count];
+};
+
+template <typename T>
+std::atomic<uint64_t> GlobalCounters<T>::values[counter_count];
+
+// Counts of one array. A copy starts with the counts of the array it was
+// copied from, so nothing is lost when copy-on-write replaces the storage.
+class Counters {
+  uint64_t values[counter_count] = { };
+
+public:
+  void record(Counter counter, uint64_t n = 1) {
+    values[size_t(counter)] += n;
+    GlobalCounters<>::values[size_t(counter)].fetch_add(n,
+      std::memory_order_relaxed);
+  }
+
+  Statistics get_statistics() const {
+    Statistics result;
+    std::copy(values, values + counter_count, result.values);
+    return result;
+  }
+
+  static void swap(Counters & lhs, Counters & rhs) {
+    std::swap(lhs.values, rhs.values);
+  }
+};
+
+#else
+
+class Counters {
+public:
+  void record(Counter, uint64_t = 1) { }
+  Statistics get_statistics() const { return Statistics(); }
+  static void swap(Counters &, Counters &) { }
+};
+
+#endif
+
+}
+
+// Totals since the start of the program or the last reset
+inline Statistics get_global_statistics() {
+  Statistics result;
+#ifdef SSA_STATISTICS
+  for (size_t i = 0; i < ssa::counter_count; ++i) {
+    result.values[i] =
+      ssa::GlobalCounters<>::values[i].load(std::memory_order_relaxed);
+  }
+#endif
+  return result;
+}
+
+inline void reset_global_statistics() {
+#ifdef SSA_STATISTICS
+  for (auto & value : ssa::GlobalCounters<>::values) {
+    value.store(0, std::memory_order_relaxed);
+  }
+#endif
+}
+
+}
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "Implementation.hpp"
+#include "Symv.hpp"
+#include "ThreadPool.hpp"
 
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
 
 namespace metaprogramming {
 
@@ -22,12 +27,88 @@ struct ImplementationHolder {
   ImplementationHolder(size_t rank, Allocator allocator)
     : is_sharable(true)
     , implementation(rank, allocator) { }
+
+  template <typename Build>
+  ImplementationHolder(size_t rank, Build build, Allocator allocator)
+    : is_sharable(true)
+    , implementation(rank, build, allocator) { }
+
+  ImplementationHolder(size_t rank, size_t capacity, ValueType * data,
+      Allocator allocator)
+    : is_sharable(true)
+    , implementation(rank, capacity, data, allocator) { }
+
+  ImplementationHolder(const ImplementationHolder & o,
+      const std::vector<size_t> & perm)
+    : is_sharable(true)
+    , implementation(o.implementation, perm) { }
 };
 
+// Constructs element (row, col) of rows [first, last) of a raw packed
+// triangle from f(row, col) on the calling thread. If anything throws, the
+// elements constructed so far are destroyed again.
+template <typename ValueType, typename F>
+void construct_rows(size_t first, size_t last, ValueType * data, F & f) {
+  ValueType * begin = data + first * (first + 1) / 2;
+  ValueType * it = begin;
+  try {
+    for (size_t row = first; row < last; ++row) {
+      for (size_t col = 0; col <= row; ++col, ++it) {
+        new (it) ValueType(f(row, col));
+      }
+    }
+  } catch (...) {
+    for (; begin != it; ++begin) begin->~ValueType();
+    throw;
+  }
 }
 
-template <typename ValueType, typename Allocator = std::allocator<ValueType>>
+// Same as construct_rows() over the whole triangle, each balanced chunk of
+// rows on the pool. If anything throws, every element constructed so far
+// is destroyed again.
+template <typename ValueType, typename F>
+void generate_rows(size_t rank, ValueType * data, F & f, ThreadPool & pool) {
+  std::vector<size_t> bounds = partition_rows(rank, pool);
+  size_t chunks = bounds.size() - 1;
+  std::vector<char> done(chunks, false);
+  auto destroy = [](ValueType * begin, ValueType * end) {
+    for (; begin != end; ++begin) begin->~ValueType();
+  };
+  auto build = [&](size_t k) {
+    construct_rows(bounds[k], bounds[k + 1], data, f);
+    done[k] = true;
+  };
+  try {
+    if (chunks == 1) build(0);
+    else pool.run(chunks, build);
+  } catch (...) {
+    for (size_t k = 0; k < chunks; ++k) {
+      if (!done[k]) continue;
+      destroy(data + bounds[k] * (bounds[k] + 1) / 2,
+        data + bounds[k + 1] * (bounds[k + 1] + 1) / 2);
+    }
+    throw;
+  }
+}
+
+// Storage layouts SymmetricSquareArray can be instantiated with. Dense
+// stores the whole packed triangle; sparse stores only the cells that differ
+// from nil, see SparseSymmetricSquareArray.hpp; bit packs bool cells one
+// bit each, see BitSymmetricSquareArray.hpp.
+struct DenseLayout { };
+struct SparseLayout { };
+struct BitLayout { };
+
+}
+
+template <
+  typename ValueType,
+  typename Allocator = std::allocator<ValueType>,
+  typename Layout = ssa::DenseLayout>
 class SymmetricSquareArray {
+  static_assert(std::is_same<Layout, ssa::DenseLayout>::value,
+    "Unknown storage layout");
+
   using ImplementationHolderType =
     ssa::ImplementationHolder<ValueType, Allocator>;
   using ImplementationType =
@@ -35,23 +116,44 @@ class SymmetricSquareArray {
 
   std::shared_ptr<ImplementationHolderType> holder;
 
+  // Deep copy, allocated the way a copied container would allocate.
+  static std::shared_ptr<ImplementationHolderType> clone(
+      const ImplementationHolderType & o) {
+    auto result = std::allocate_shared<ImplementationHolderType>(
+      std::allocator_traits<Allocator>::select_on_container_copy_construction(
+        o.implementation.get_allocator()),
+      o);
+    result->implementation.record(Counter::clones);
+    return result;
+  }
+
   void ensure_unique() {
     if (holder.unique()) return;
-    holder = std::allocate_shared<ImplementationHolderType>(
-      holder->implementation.get_allocator(),
-      *holder);
+    holder = clone(*holder);
   }
 
   void enable_sharing() {
     ensure_unique();
+    if (!holder->is_sharable) {
+      holder->implementation.record(Counter::sharing_changes);
+    }
     holder->is_sharable = true;
   }
 
   void disable_sharing() {
     ensure_unique();
+    if (holder->is_sharable) {
+      holder->implementation.record(Counter::sharing_changes);
+    }
     holder->is_sharable = false;
   }
 
+  template <typename Build>
+  SymmetricSquareArray(size_t rank, Build build, Allocator allocator)
+    : holder(
+      std::allocate_shared<ImplementationHolderType>(
+        allocator, rank, build, allocator)) { }
+
 public:
   SymmetricSquareArray(Allocator allocator = Allocator())
     : holder(
@@ -65,14 +167,64 @@ public:
 
   SymmetricSquareArray(const SymmetricSquareArray & o)
     : holder(
-      o.holder->is_sharable
-      ? o.holder
-      : std::allocate_shared<ImplementationHolderType>(
-        o.holder->implementation.get_allocator(),
-        *o.holder)) { }
+      o.holder->is_sharable ? o.holder : clone(*o.holder)) { }
 
   SymmetricSquareArray(SymmetricSquareArray &&) = default;
 
+  // Builds an array whose element (row, col) is f(row, col), calling f
+  // once per stored element (col <= row). Elements are constructed in
+  // place by the pool, so every page is first touched by the thread that
+  // computes it. f is called concurrently.
+  template <typename F>
+  static SymmetricSquareArray generate(size_t rank, F f,
+      ThreadPool & pool = default_thread_pool(),
+      Allocator allocator = Allocator()) {
+    return SymmetricSquareArray(rank,
+      [&](ValueType * data) { ssa::generate_rows(rank, data, f, pool); },
+      allocator);
+  }
+
+  // Same as generate(), but builds on the calling thread, so that copying
+  // a handful of elements never starts a pool, and calls f row by row in
+  // column order. The result is sharable, unlike an array filled through
+  // triangle_begin().
+  template <typename F>
+  static SymmetricSquareArray from_function(size_t rank, F f,
+      Allocator allocator = Allocator()) {
+    return SymmetricSquareArray(rank,
+      [&](ValueType * data) { ssa::construct_rows(size_t(0), rank, data, f); },
+      allocator);
+  }
+
+  // Wraps a buffer obtained from allocator, e.g. a file mapping, whose
+  // beginning already holds the packed triangle of the given rank, without
+  // copying it. The array releases it with allocator.deallocate(data,
+  // capacity).
+  static SymmetricSquareArray adopt(size_t rank, size_t capacity,
+      ValueType * data, Allocator allocator = Allocator()) {
+    SymmetricSquareArray result(allocator);
+    try {
+      result.holder = std::allocate_shared<ImplementationHolderType>(
+        allocator, rank, capacity, data, allocator);
+    } catch (...) {
+      std::allocator_traits<Allocator>::deallocate(allocator, data, capacity);
+      throw;
+    }
+    return result;
+  }
+
+  // Same as the rank constructor with every element a copy of value, but
+  // built in parallel, so that on a NUMA machine the rows end up next to
+  // the threads that process them.
+  static SymmetricSquareArray filled(size_t rank,
+      const ValueType & value = ValueType(),
+      ThreadPool & pool = default_thread_pool(),
+      Allocator allocator = Allocator()) {
+    return generate(rank,
+      [&](size_t, size_t) -> const ValueType & { return value; },
+      pool, allocator);
+  }
+
   template <typename T>
   void insert(size_t row, size_t col,
         T && val,
@@ -81,13 +233,64 @@ public:
     holder->implementation.insert(row, col, std::forward<T>(val), nil);
   }
 
+  void insert_rows(const std::vector<size_t> & positions,
+      const ValueType & val,
+      const ValueType & nil = ValueType()) {
+    enable_sharing();
+    holder->implementation.insert_rows(positions, val, nil);
+  }
+
   void erase(size_t row, size_t col) {
     enable_sharing();
     holder->implementation.erase(row, col);
   }
 
+  void erase_rows(const std::vector<size_t> & indices) {
+    enable_sharing();
+    holder->implementation.erase_rows(indices);
+  }
+
+  template <typename Predicate>
+  void erase_rows_if(Predicate pred) {
+    enable_sharing();
+    holder->implementation.erase_rows_if(pred);
+  }
+
+  // Reorders rows and columns alike so that new index i is old index
+  // perm[i], i.e. applies P * A * P^T in place. perm has to be a
+  // permutation of [0, get_rank()), e.g. from reverse_cuthill_mckee().
+  void permute(const std::vector<size_t> & perm) {
+    if (holder.unique()) {
+      enable_sharing();
+      holder->implementation.permute(perm);
+      return;
+    }
+    // Gathered straight from the shared triangle instead of detaching
+    // first, which would copy it twice
+    auto result = std::allocate_shared<ImplementationHolderType>(
+      std::allocator_traits<Allocator>::select_on_container_copy_construction(
+        holder->implementation.get_allocator()),
+      *holder, perm);
+    result->implementation.record(Counter::clones);
+    holder = std::move(result);
+  }
+
+  void reserve(size_t rank) {
+    enable_sharing();
+    holder->implementation.reserve(rank);
+  }
+
+  void shrink_to_fit() {
+    enable_sharing();
+    holder->implementation.shrink_to_fit();
+  }
+
   size_t get_rank() const { return holder->implementation.get_rank(); }
 
+  size_t get_capacity() const {
+    return holder->implementation.get_capacity();
+  }
+
   Allocator get_allocator() const {
     return holder->implementation.get_allocator();
   }
@@ -129,8 +332,54 @@ public:
   ConstIterator cbegin() const { return holder->implementation.cbegin(); }
   ConstIterator cend()   const { return holder->implementation.cend(); }
 
+  using Row      = typename ImplementationType::Row;
+  using ConstRow = typename ImplementationType::ConstRow;
+
+  Row row(size_t r) {
+    disable_sharing();
+    return holder->implementation.row(r);
+  }
+
+  ConstRow row(size_t r) const { return holder->implementation.row(r); }
+
+  ValueType * triangle_begin() {
+    disable_sharing();
+    return holder->implementation.triangle_begin();
+  }
+
+  ValueType * triangle_end() {
+    disable_sharing();
+    return holder->implementation.triangle_end();
+  }
+
+  const ValueType * triangle_begin() const {
+    return holder->implementation.triangle_begin();
+  }
+
+  const ValueType * triangle_end() const {
+    return holder->implementation.triangle_end();
+  }
+
+  // y = alpha * A * x + beta * y, where x and y hold get_rank() elements
+  // and must not overlap. Vectorized for float and double.
+  void symv(const ValueType * x, ValueType * y,
+      ValueType alpha = ValueType(1),
+      ValueType beta = ValueType(0)) const {
+    ssa::symv(get_rank(), holder->implementation.triangle_begin(),
+      x, y, alpha, beta);
+  }
+
   long get_reference_count() const { return holder.use_count(); }
   bool get_is_sharable() const { return holder->is_sharable; }
+
+  // Counts for this array and the ones it was copied from, all zero unless
+  // built with SSA_STATISTICS, see Statistics.hpp.
+  Statistics get_statistics() const {
+    return holder->implementation.get_statistics();
+  }
 };
 
 }
+
+#include "BitSymmetricSquareArray.hpp"
+#include "SparseSymmetricSquareArray.hpp"
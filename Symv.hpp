@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SSA_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace metaprogramming {
+
+namespace ssa {
+
+// Symmetric matrix-vector product y = alpha * A * x + beta * y where A is
+// given as the packed lower triangle (0, 0), (1, 0), (1, 1), ... of rank
+// rows. Row r contributes a dot product with x[0, r) to y[r] and, by
+// symmetry, x[r] times the same elements to y[0, r), so every stored element
+// is read once. x and y must not overlap.
+//
+// The kernels add alpha times the contribution of rows [first, last) to
+// y[0, last), which lets callers split the work by rows.
+
+template <typename T>
+void scale(size_t rank, T * y, T beta) {
+  if (beta == T(0)) {
+    for (size_t i = 0; i < rank; ++i) y[i] = T(0);
+  } else if (beta != T(1)) {
+    for (size_t i = 0; i < rank; ++i) y[i] *= beta;
+  }
+}
+
+template <typename T>
+void symv_scalar(size_t first, size_t last, const T * packed,
+    const T * x, T * y, T alpha) {
+  for (size_t r = first; r < last; ++r) {
+    const T * a = packed + r * (r + 1) / 2;
+    T xr = alpha * x[r];
+    T dot = T(0);
+    for (size_t c = 0; c < r; ++c) {
+      dot += a[c] * x[c];
+      y[c] += a[c] * xr;
+    }
+    y[r] += alpha * dot + a[r] * xr;
+  }
+}
+
+#ifdef SSA_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+inline void symv_avx2(size_t first, size_t last, const double * packed,
+    const double * x, double * y, double alpha) {
+  for (size_t r = first; r < last; ++r) {
+    const double * a = packed + r * (r + 1) / 2;
+    double xr = alpha * x[r];
+    __m256d vxr = _mm256_set1_pd(xr);
+    __m256d acc = _mm256_setzero_pd();
+    size_t c = 0;
+    for (; c + 4 <= r; c += 4) {
+      __m256d va = _mm256_loadu_pd(a + c);
+      acc = _mm256_fmadd_pd(va, _mm256_loadu_pd(x + c), acc);
+      _mm256_storeu_pd(y + c,
+        _mm256_fmadd_pd(va, vxr, _mm256_loadu_pd(y + c)));
+    }
+    __m128d sum = _mm_add_pd(
+      _mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    double dot = _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+    for (; c < r; ++c) {
+      dot += a[c] * x[c];
+      y[c] += a[c] * xr;
+    }
+    y[r] += alpha * dot + a[r] * xr;
+  }
+}
+
+__attribute__((target("avx2,fma")))
+inline void symv_avx2(size_t first, size_t last, const float * packed,
+    const float * x, float * y, float alpha) {
+  for (size_t r = first; r < last; ++r) {
+    const float * a = packed + r * (r + 1) / 2;
+    float xr = alpha * x[r];
+    __m256 vxr = _mm256_set1_ps(xr);
+    __m256 acc = _mm256_setzero_ps();
+    size_t c = 0;
+    for (; c + 8 <= r; c += 8) {
+      __m256 va = _mm256_loadu_ps(a + c);
+      acc = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + c), acc);
+      _mm256_storeu_ps(y + c,
+        _mm256_fmadd_ps(va, vxr, _mm256_loadu_ps(y + c)));
+    }
+    __m128 sum = _mm_add_ps(
+      _mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    float dot = _mm_cvtss_f32(sum);
+    for (; c < r; ++c) {
+      dot += a[c] * x[c];
+      y[c] += a[c] * xr;
+    }
+    y[r] += alpha * dot + a[r] * xr;
+  }
+}
+
+__attribute__((target("avx512f")))
+inline void symv_avx512(size_t first, size_t last, const double * packed,
+    const double * x, double * y, double alpha) {
+  for (size_t r = first; r < last; ++r) {
+    const double * a = packed + r * (r + 1) / 2;
+    double xr = alpha * x[r];
+    __m512d vxr = _mm512_set1_pd(xr);
+    __m512d acc = _mm512_setzero_pd();
+    size_t c = 0;
+    for (; c + 8 <= r; c += 8) {
+      __m512d va = _mm512_loadu_pd(a + c);
+      acc = _mm512_fmadd_pd(va, _mm512_loadu_pd(x + c), acc);
+      _mm512_storeu_pd(y + c,
+        _mm512_fmadd_pd(va, vxr, _mm512_loadu_pd(y + c)));
+    }
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, acc);
+    double dot = 0;
+    for (double lane : lanes) dot += lane;
+    for (; c < r; ++c) {
+      dot += a[c] * x[c];
+      y[c] += a[c] * xr;
+    }
+    y[r] += alpha * dot + a[r] * xr;
+  }
+}
+
+__attribute__((target("avx512f")))
+inline void symv_avx512(size_t first, size_t last, const float * packed,
+    const float * x, float * y, float alpha) {
+  for (size_t r = first; r < last; ++r) {
+    const float * a = packed + r * (r + 1) / 2;
+    float xr = alpha * x[r];
+    __m512 vxr = _mm512_set1_ps(xr);
+    __m512 acc = _mm512_setzero_ps();
+    size_t c = 0;
+    for (; c + 16 <= r; c += 16) {
+      __m512 va = _mm512_loadu_ps(a + c);
+      acc = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + c), acc);
+      _mm512_storeu_ps(y + c,
+        _mm512_fmadd_ps(va, vxr, _mm512_loadu_ps(y + c)));
+    }
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, acc);
+    float dot = 0;
+    for (float lane : lanes) dot += lane;
+    for (; c < r; ++c) {
+      dot += a[c] * x[c];
+      y[c] += a[c] * xr;
+    }
+    y[r] += alpha * dot + a[r] * xr;
+  }
+}
+
+#endif
+
+template <typename T>
+using SymvKernel = void (*)(size_t, size_t, const T *, const T *, T *, T);
+
+template <typename T>
+SymvKernel<T> select_symv_kernel(T) { return symv_scalar<T>; }
+
+template <typename T>
+SymvKernel<T> select_simd_symv_kernel() {
+#ifdef SSA_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return symv_avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return symv_avx2;
+  }
+#endif
+  return symv_scalar<T>;
+}
+
+inline SymvKernel<double> select_symv_kernel(double) {
+  return select_simd_symv_kernel<double>();
+}
+
+inline SymvKernel<float> select_symv_kernel(float) {
+  return select_simd_symv_kernel<float>();
+}
+
+// Picks the widest kernel the CPU supports on first use.
+template <typename T>
+void symv_rows(size_t first, size_t last, const T * packed,
+    const T * x, T * y, T alpha) {
+  static const SymvKernel<T> kernel = select_symv_kernel(T());
+  kernel(first, last, packed, x, y, alpha);
+}
+
+template <typename T>
+void symv(size_t rank, const T * packed, const T * x, T * y,
+    T alpha, T beta) {
+  scale(rank, y, beta);
+  symv_rows(size_t(0), rank, packed, x, y, alpha);
+}
+
+}
+
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace metaprogramming {
+
+// Small work-stealing thread pool. Every worker owns a deque: it pops its
+// own tasks from the back and steals from the front of the others when it
+// runs dry.
+class ThreadPool {
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next_queue;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  size_t pending;
+  bool stopping;
+
+  bool try_pop(size_t index, bool own, std::function<void()> & task) {
+    Queue & queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    if (own) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+
+  // Runs one task, preferring the queue at index home. Returns false if
+  // every queue was empty.
+  bool try_run(size_t home) {
+    std::function<void()> task;
+    bool found = try_pop(home, true, task);
+    for (size_t i = 1; !found && i < queues.size(); ++i) {
+      found = try_pop((home + i) % queues.size(), false, task);
+    }
+    if (!found) return false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --pending;
+    }
+    task();
+    return true;
+  }
+
+  void work(size_t index) {
+    for (;;) {
+      if (try_run(index)) continue;
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return pending != 0 || stopping; });
+      if (stopping && pending == 0) return;
+    }
+  }
+
+public:
+  explicit ThreadPool(
+      size_t thread_count = std::thread::hardware_concurrency())
+      : next_queue(0)
+      , pending(0)
+      , stopping(false) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i) {
+      queues.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto & thread : threads) thread.join();
+  }
+
+  size_t get_thread_count() const { return threads.size(); }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++pending;
+    }
+    Queue & queue = *queues[next_queue++ % queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Runs f(i) for every i in [0, count) and waits for all of them. The
+  // calling thread helps with the work. The first exception thrown by f is
+  // rethrown once every call has finished.
+  template <typename F>
+  void run(size_t count, F f) {
+    std::atomic<size_t> remaining(count);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    for (size_t i = 0; i < count; ++i) {
+      submit([&, i] {
+        try {
+          f(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!error) error = std::current_exception();
+        }
+        --remaining;
+      });
+    }
+    size_t home = next_queue % queues.size();
+    while (remaining != 0) {
+      if (!try_run(home)) std::this_thread::yield();
+    }
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+inline ThreadPool & default_thread_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+namespace ssa {
+
+// Packed elements below which splitting the work is not worth it
+constexpr size_t parallel_grain = 1 << 14;
+
+// Splits rows [0, rank) into consecutive ranges holding roughly the same
+// number of packed elements. Row r holds r + 1 of them, so the boundary of
+// chunk k is the row where sum_n reaches k / chunks of the triangle.
+inline std::vector<size_t> partition_rows(size_t rank, size_t chunks) {
+  size_t size = rank * (rank + 1) / 2;
+  chunks = std::max<size_t>(1, std::min(chunks, rank));
+  std::vector<size_t> bounds(1, 0);
+  for (size_t k = 1; k < chunks; ++k) {
+    double target = double(size) * k / chunks;
+    size_t row = (std::sqrt(8 * target + 1) - 1) / 2;
+    if (bounds.back() < row && row < rank) bounds.push_back(row);
+  }
+  bounds.push_back(rank);
+  return bounds;
+}
+
+inline std::vector<size_t> partition_rows(size_t rank, ThreadPool & pool) {
+  size_t size = rank * (rank + 1) / 2;
+  size_t chunks = std::min(pool.get_thread_count() * 4,
+    size / parallel_grain + 1);
+  return partition_rows(rank, chunks);
+}
+
+// Calls f(first, last) for balanced row ranges on the pool.
+template <typename F>
+void for_each_chunk(size_t rank, ThreadPool & pool, F f) {
+  std::vector<size_t> bounds = partition_rows(rank, pool);
+  size_t chunks = bounds.size() - 1;
+  if (chunks == 1) {
+    f(bounds[0], bounds[1]);
+    return;
+  }
+  pool.run(chunks, [&](size_t k) { f(bounds[k], bounds[k + 1]); });
+}
+
+}
+
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace metaprogramming {
+
+// Fixed-rank symmetric array whose packed triangle is split into tiles of
+// TileSize elements, each shared copy-on-write on its own. Copies only
+// share the tile pointers, and writing into a shared copy duplicates just
+// the tile that holds the written cell.
+template <
+  typename ValueType,
+  size_t TileSize = 4096,
+  typename Allocator = std::allocator<ValueType>>
+class TiledSymmetricSquareArray {
+  static_assert(0 < TileSize, "Tiles must hold at least one element");
+
+  struct Tile {
+    bool is_sharable;
+    std::vector<ValueType, Allocator> elements;
+
+    Tile(size_t count, const ValueType & value, Allocator allocator)
+      : is_sharable(true)
+      , elements(count, value, allocator) { }
+
+    template <typename InputIterator>
+    Tile(InputIterator begin, InputIterator end, Allocator allocator)
+      : is_sharable(true)
+      , elements(begin, end, allocator) { }
+
+    Tile(const Tile & o)
+      : is_sharable(true)
+      , elements(o.elements) { }
+  };
+
+  using TilePtr = std::shared_ptr<Tile>;
+
+  size_t rank;
+  Allocator allocator;
+  std::vector<TilePtr> tiles;
+
+  static size_t to_linear_index(size_t row, size_t col) {
+    if (row < col) std::swap(row, col);
+    return (row + 1) * row / 2 + col;
+  }
+
+  static size_t calculate_size(size_t rank) { return (rank + 1) * rank / 2; }
+
+  TilePtr clone(const Tile & tile) const {
+    return std::allocate_shared<Tile>(allocator, tile);
+  }
+
+  Tile & unique_tile(size_t index) {
+    TilePtr & tile = tiles[index];
+    if (tile.use_count() != 1) tile = clone(*tile);
+    return *tile;
+  }
+
+  template <typename InputIterator>
+  void assign(InputIterator begin, size_t size) {
+    tiles.reserve((size + TileSize - 1) / TileSize);
+    for (size_t first = 0; first < size; first += TileSize) {
+      size_t count = std::min(TileSize, size - first);
+      InputIterator end = std::next(begin, count);
+      tiles.push_back(std::allocate_shared<Tile>(
+        allocator, begin, end, allocator));
+      begin = end;
+    }
+  }
+
+public:
+  TiledSymmetricSquareArray(size_t rank = 0,
+      const ValueType & value = ValueType(),
+      Allocator allocator = Allocator())
+    : rank(rank)
+    , allocator(allocator) {
+    size_t size = calculate_size(rank);
+    for (size_t first = 0; first < size; first += TileSize) {
+      tiles.push_back(std::allocate_shared<Tile>(
+        allocator, std::min(TileSize, size - first), value, allocator));
+    }
+  }
+
+  template <typename OtherAllocator>
+  explicit TiledSymmetricSquareArray(
+      const SymmetricSquareArray<ValueType, OtherAllocator> & array,
+      Allocator allocator = Allocator())
+    : rank(array.get_rank())
+    , allocator(allocator) {
+    assign(array.triangle_begin(), calculate_size(rank));
+  }
+
+  TiledSymmetricSquareArray(const TiledSymmetricSquareArray & o)
+    : rank(o.rank)
+    , allocator(o.allocator)
+    , tiles(o.tiles) {
+    for (auto & tile : tiles) {
+      if (!tile->is_sharable) tile = clone(*tile);
+    }
+  }
+
+  TiledSymmetricSquareArray(TiledSymmetricSquareArray &&) = default;
+
+  TiledSymmetricSquareArray & operator=(TiledSymmetricSquareArray o) {
+    swap(*this, o);
+    return *this;
+  }
+
+  static void swap(TiledSymmetricSquareArray & lhs,
+      TiledSymmetricSquareArray & rhs) {
+    std::swap(lhs.rank, rhs.rank);
+    std::swap(lhs.allocator, rhs.allocator);
+    std::swap(lhs.tiles, rhs.tiles);
+  }
+
+  const ValueType & operator()(size_t row, size_t col) const {
+    size_t i = to_linear_index(row, col);
+    return tiles[i / TileSize]->elements[i % TileSize];
+  }
+
+  // Hands out a reference, so the tile stops being shared by later copies.
+  ValueType & operator()(size_t row, size_t col) {
+    size_t i = to_linear_index(row, col);
+    Tile & tile = unique_tile(i / TileSize);
+    tile.is_sharable = false;
+    return tile.elements[i % TileSize];
+  }
+
+  // Writes one cell, copying at most the tile that holds it.
+  template <typename T>
+  void set(size_t row, size_t col, T && value) {
+    size_t i = to_linear_index(row, col);
+    unique_tile(i / TileSize).elements[i % TileSize] = std::forward<T>(value);
+  }
+
+  // Copies the contents into a plain array.
+  template <typename OtherAllocator = std::allocator<ValueType>>
+  SymmetricSquareArray<ValueType, OtherAllocator> to_array(
+      OtherAllocator allocator = OtherAllocator()) const {
+    return SymmetricSquareArray<ValueType, OtherAllocator>::from_function(
+      rank,
+      [&](size_t row, size_t col) -> const ValueType & {
+        size_t i = to_linear_index(row, col);
+        return tiles[i / TileSize]->elements[i % TileSize];
+      },
+      allocator);
+  }
+
+  size_t get_rank() const { return rank; }
+
+  size_t get_tile_count() const { return tiles.size(); }
+
+  Allocator get_allocator() const { return allocator; }
+
+  // Number of arrays sharing the tile that holds (row, col)
+  long get_reference_count(size_t row, size_t col) const {
+    return tiles[to_linear_index(row, col) / TileSize].use_count();
+  }
+};
+
+}
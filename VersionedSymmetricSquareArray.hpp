@@ -0,0 +1,70 @@
+#pragma once
+
+#include "SymmetricSquareArray.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace metaprogramming {
+
+// Multi-version wrapper for one writer and any number of concurrent readers.
+// Readers take snapshots: immutable versions that stay valid for as long as
+// they are held, whatever the writer does meanwhile. The writer prepares
+// the next version on a copy-on-write clone of the current one and
+// publishes it atomically. A version is reclaimed as soon as the last
+// snapshot of it is dropped. Snapshots are not lock-free, see snapshot().
+template <typename ValueType, typename Allocator = std::allocator<ValueType>>
+class VersionedSymmetricSquareArray {
+public:
+  using Array = SymmetricSquareArray<ValueType, Allocator>;
+  using Snapshot = std::shared_ptr<const Array>;
+
+private:
+  Snapshot current;
+  std::atomic<uint64_t> version;
+  std::mutex writer;
+
+public:
+  explicit VersionedSymmetricSquareArray(Array initial = Array())
+    : current(std::make_shared<const Array>(std::move(initial)))
+    , version(0) { }
+
+  VersionedSymmetricSquareArray(const VersionedSymmetricSquareArray &) =
+    delete;
+  VersionedSymmetricSquareArray & operator=(
+    const VersionedSymmetricSquareArray &) = delete;
+
+  // Never waits for an update in progress, only for the short lock that
+  // std::atomic_load on a shared_ptr takes: libstdc++ guards it with a
+  // global pool of spinlocks, held just for the reference count. Readers
+  // may therefore spin briefly against each other and against publishing.
+  Snapshot snapshot() const { return std::atomic_load(&current); }
+
+  // Runs f on a private copy of the latest version and publishes the result.
+  // Writers are serialized. If f throws, nothing is published.
+  template <typename F>
+  void update(F f) {
+    std::lock_guard<std::mutex> lock(writer);
+    Array next(*std::atomic_load(&current));
+    f(next);
+    std::atomic_store(&current, Snapshot(
+      std::make_shared<const Array>(std::move(next))));
+    ++version;
+  }
+
+  // Replaces the contents with an independently built version.
+  void publish(Array next) {
+    std::lock_guard<std::mutex> lock(writer);
+    std::atomic_store(&current, Snapshot(
+      std::make_shared<const Array>(std::move(next))));
+    ++version;
+  }
+
+  // Number of versions published so far
+  uint64_t get_version() const { return version; }
+};
+
+}